@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Charset transcoding.
+ *
+ * Text is UTF-8 inside HFTIrc.  A server (charset) or a channel
+ * (channel_charset) can be given another charset in [server]:
+ * incoming lines that aren't valid UTF-8 are converted from it, and
+ * outgoing lines are converted to it.  Pure ASCII lines are never
+ * touched.  iconv descriptors are opened once per charset and kept.
+ */
+
+#include <iconv.h>
+#include <errno.h>
+
+#include "hftirc.h"
+
+static Charset *charsethead = NULL;
+
+/* Cached descriptors of charset name, NULL for UTF-8 or if unknown */
+Charset*
+charset_get(const char *name)
+{
+     Charset *cs;
+
+     if(!name || !strlen(name) || !strcasecmp(name, "utf-8") || !strcasecmp(name, "utf8"))
+          return NULL;
+
+     for(cs = charsethead; cs; cs = cs->next)
+          if(!strcasecmp(cs->name, name))
+               return cs;
+
+     cs = xcalloc(1, sizeof(Charset));
+     strncpy(cs->name, name, CHARSETLEN - 1);
+
+     if((cs->in = iconv_open("UTF-8", name)) == (iconv_t)-1)
+     {
+          ui_print_buf(hftirc.statuscb, "[HFTIrc] Unknown charset: %s", name);
+          free(cs);
+
+          return NULL;
+     }
+
+     if((cs->out = iconv_open(name, "UTF-8")) == (iconv_t)-1)
+     {
+          iconv_close(cs->in);
+          free(cs);
+
+          return NULL;
+     }
+
+     cs->next = charsethead;
+     charsethead = cs;
+
+     return cs;
+}
+
+/* Charset configured for chan (NULL: the server one) of server serv */
+Charset*
+charset_conf(const char *serv, const char *chan)
+{
+     int i, j;
+     char *p;
+     size_t len;
+
+     if(!serv)
+          return NULL;
+
+     for(i = 0; i < hftirc.conf.nserv; ++i)
+     {
+          if(strcmp(serv, hftirc.conf.serv[i].name))
+               continue;
+
+          if(!chan)
+               return charset_get(hftirc.conf.serv[i].charset);
+
+          /* "#chan:charset" */
+          for(j = 0; j < hftirc.conf.serv[i].nchancharset; ++j)
+               if((p = strrchr(hftirc.conf.serv[i].chancharset[j], ':'))
+                         && (len = p - hftirc.conf.serv[i].chancharset[j]) == strlen(chan)
+                         && !strncasecmp(chan, hftirc.conf.serv[i].chancharset[j], len))
+                    return charset_get(p + 1);
+
+          return NULL;
+     }
+
+     return NULL;
+}
+
+/* Charset of the target of a raw line: the first channel among the first
+ * two parameters (after prefix and command) if it has its own charset,
+ * else the server one.
+ */
+static Charset*
+charset_target(IrcSession *s, const char *buf, int len)
+{
+     char chan[HOSTLEN];
+     ChanBuf *cb;
+     int i = 0, j, n;
+
+     if(buf[0] == ':')
+          for(; i < len && buf[i] != ' '; ++i);
+
+     /* Command */
+     for(; i < len && buf[i] == ' '; ++i);
+     for(; i < len && buf[i] != ' '; ++i);
+
+     for(n = 0; n < 2 && i < len; ++n)
+     {
+          for(; i < len && buf[i] == ' '; ++i);
+
+          if(i >= len || buf[i] == ':')
+               break;
+
+          for(j = 0; i < len && buf[i] != ' ' && j < HOSTLEN - 1; chan[j++] = buf[i++]);
+          chan[j] = '\0';
+
+          if(ISCHAN(chan[0]))
+          {
+               if((cb = find_buf(s, chan)) && cb->charset)
+                    return cb->charset;
+
+               break;
+          }
+     }
+
+     return s->charset;
+}
+
+/* Convert len bytes of buf in place (size bytes at most, nul included).
+ * Characters that can't be converted become '?'.
+ */
+static int
+charset_conv(iconv_t cd, char *buf, int len, size_t size, Bool toutf8)
+{
+     char tmp[BUFSIZE * 2];
+     char *in = buf, *out = tmp;
+     size_t inl = len, outl = sizeof(tmp);
+     wchar_t wc;
+     int n;
+
+     /* Reset shift state */
+     iconv(cd, NULL, NULL, NULL, NULL);
+
+     while(inl && iconv(cd, &in, &inl, &out, &outl) == (size_t)-1)
+     {
+          if((errno != EILSEQ && errno != EINVAL) || !outl)
+               break;
+
+          /* Skip one input character */
+          n = (toutf8 ? 1 : utf8_decode(in, inl, &wc));
+          in += n;
+          inl -= n;
+
+          *out++ = '?';
+          --outl;
+     }
+
+     if((n = sizeof(tmp) - outl) > (int)size - 1)
+          n = size - 1;
+
+     memcpy(buf, tmp, n);
+     buf[n] = '\0';
+
+     return n;
+}
+
+/* Incoming raw line to UTF-8, return its new length */
+int
+charset_in(IrcSession *s, char *buf, int len, size_t size)
+{
+     Charset *cs;
+
+     if(utf8_valid(buf, len) || !(cs = charset_target(s, buf, len)))
+          return len;
+
+     return charset_conv(cs->in, buf, len, size, True);
+}
+
+/* Outgoing raw line (nul terminated) from UTF-8 */
+void
+charset_out(IrcSession *s, char *buf, size_t size)
+{
+     Charset *cs;
+     int len = strlen(buf);
+
+     if(ascii_len(buf, len) == len || !(cs = charset_target(s, buf, len)))
+          return;
+
+     charset_conv(cs->out, buf, len, size, False);
+
+     return;
+}
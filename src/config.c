@@ -35,6 +35,9 @@ static void
 config_misc(void)
 {
      struct conf_sec *misc;
+     struct opt_type *opt;
+     char *dir;
+     long i, n;
 
      misc = fetch_section_first(NULL, "misc");
 
@@ -42,6 +45,67 @@ config_misc(void)
      hftirc.conf.bell   = fetch_opt_first(misc, "false", "bell").boolean;
      hftirc.conf.nicklist = fetch_opt_first(misc, "false", "nicklist_enable").boolean;
      hftirc.conf.lastlinepos = fetch_opt_first(misc, "false", "lastline_position").boolean;
+
+     /* Screen updates per second at most, 0: no limit */
+     if((hftirc.conf.framerate = fetch_opt_first(misc, "60", "frame_rate").num) < 0)
+          hftirc.conf.framerate = 0;
+
+     /* Highlight words and "/regex/", see highlight.c */
+     opt = fetch_opt(misc, "", "highlight");
+
+     if((n = fetch_opt_count(opt)) > LEN(hftirc.conf.highlight))
+     {
+          ui_print_buf(0, "HFTIrc configuration: too many highlight (%ld).", n);
+          n = LEN(hftirc.conf.highlight);
+     }
+
+     for(i = 0; i < n; ++i)
+          strncpy(hftirc.conf.highlight[i], opt[i].str, HLLEN - 1);
+
+     hftirc.conf.nhighlight = n;
+
+     /* Command aliases, see input.c */
+     opt = fetch_opt(misc, "", "alias");
+
+     if((n = fetch_opt_count(opt)) > LEN(hftirc.conf.alias))
+     {
+          ui_print_buf(0, "HFTIrc configuration: too many alias (%ld).", n);
+          n = LEN(hftirc.conf.alias);
+     }
+
+     for(i = 0; i < n; ++i)
+          strncpy(hftirc.conf.alias[i], opt[i].str, ALIASLEN - 1);
+
+     hftirc.conf.nalias = n;
+
+     /* Scrollback limits, per buffer */
+     if((n = fetch_opt_first(misc, "1024", "scrollback_lines").num) < 1)
+          n = 1024;
+     hftirc.conf.scrolllines = n;
+
+     if((n = fetch_opt_first(misc, "262144", "scrollback_size").num) < SCROLLCHUNK)
+          n = SCROLLCHUNK;
+     hftirc.conf.scrollsize = n;
+
+     /* Older lines go to files instead of being dropped */
+     hftirc.conf.spill = fetch_opt_first(misc, "false", "scrollback_spill").boolean;
+
+     if((dir = fetch_opt_first(misc, "", "scrollback_spill_dir").str) && strlen(dir))
+          strncpy(hftirc.conf.spilldir, dir, FILENAME_MAX);
+     else
+          strncpy(hftirc.conf.spilldir, (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp"), FILENAME_MAX);
+
+     /* Input history, see history.c */
+     if((n = fetch_opt_first(misc, "1000", "history_lines").num) < 1)
+          n = 1000;
+     hftirc.conf.histlines = n;
+
+     hftirc.conf.histsave = fetch_opt_first(misc, "false", "history_save").boolean;
+
+     if((dir = fetch_opt_first(misc, "", "history_file").str) && strlen(dir))
+          strncpy(hftirc.conf.histpath, dir, FILENAME_MAX);
+     else
+          snprintf(hftirc.conf.histpath, FILENAME_MAX, "%s/"DEF_HISTORY, getenv("HOME"));
 }
 
 static void
@@ -72,25 +136,49 @@ config_ui(void)
      hftirc.conf.tcolor = color_to_id(fetch_opt_first(colors, "blue", "color_theme").str);
 }
 
+static void
+config_control(void)
+{
+     struct conf_sec *ctl;
+     char *path;
+
+     ctl = fetch_section_first(NULL, "control");
+
+     hftirc.conf.ctl = fetch_opt_first(ctl, "false", "enable").boolean;
+     hftirc.conf.ctlqueue = fetch_opt_first(ctl, "65536", "queue_size").num;
+     hftirc.conf.ctldrop = strcmp(fetch_opt_first(ctl, "drop", "overflow").str, "disconnect");
+
+     if(hftirc.conf.ctlqueue < BUFSIZE * 2)
+          hftirc.conf.ctlqueue = BUFSIZE * 2;
+
+     if((path = fetch_opt_first(ctl, "", "path").str))
+          strncpy(hftirc.conf.ctlpath, path, FILENAME_MAX);
+     else
+          snprintf(hftirc.conf.ctlpath, FILENAME_MAX, "%s/"DEF_CTLSOCK, getenv("HOME"));
+}
+
 static void
 config_server(void)
 {
      int i, j, n = 0;
      struct conf_sec **serv;
      struct opt_type *opt;
+     char *cs;
      ServInfo defsi = { "Hft", "irc.freenode.net", "", 6667, "hftircuser", " ", "HFTIrcuser", "HFTIrcuser"};
 
      if(!(serv = fetch_section(fetch_section_first(NULL, "servers"), "server"))
                || !(hftirc.conf.nserv = fetch_section_count(serv)))
      {
-          hftirc.conf.serv = malloc(sizeof(ServInfo));
+          hftirc.conf.serv = xcalloc(1, sizeof(ServInfo));
           hftirc.conf.serv[0] = defsi;
           hftirc.conf.nserv = 1;
 
           return;
      }
 
-     hftirc.conf.serv = malloc(sizeof(ServInfo) * hftirc.conf.nserv);
+     /* Zeroed: optional strings stay empty, and strncpy() of size - 1
+      * keeps them terminated */
+     hftirc.conf.serv = xcalloc(hftirc.conf.nserv, sizeof(ServInfo));
 
      for(i = 0; i < hftirc.conf.nserv; ++i)
      {
@@ -114,6 +202,37 @@ config_server(void)
                     for(j = 0; j < n; ++j)
                          SSTRCPY(hftirc.conf.serv[i].autojoin[j], opt[j].str);
           }
+
+          /* Charset of the server and of some channels ("#chan:charset") */
+          if((cs = fetch_opt_first(serv[i], "", "charset").str))
+               strncpy(hftirc.conf.serv[i].charset, cs, CHARSETLEN - 1);
+
+          opt = fetch_opt(serv[i], "", "channel_charset");
+
+          if((n = fetch_opt_count(opt)) > LEN(hftirc.conf.serv[i].chancharset))
+          {
+               ui_print_buf(0, "HFTIrc configuration: section serv (%d), too many channel_charset (%d).", i, n);
+               n = LEN(hftirc.conf.serv[i].chancharset);
+          }
+
+          for(j = 0; j < n; ++j)
+               strncpy(hftirc.conf.serv[i].chancharset[j], opt[j].str, CHANLEN + CHARSETLEN - 1);
+
+          hftirc.conf.serv[i].nchancharset = n;
+
+          /* Highlight words of this server only */
+          opt = fetch_opt(serv[i], "", "highlight");
+
+          if((n = fetch_opt_count(opt)) > LEN(hftirc.conf.serv[i].highlight))
+          {
+               ui_print_buf(0, "HFTIrc configuration: section serv (%d), too many highlight (%d).", i, n);
+               n = LEN(hftirc.conf.serv[i].highlight);
+          }
+
+          for(j = 0; j < n; ++j)
+               strncpy(hftirc.conf.serv[i].highlight[j], opt[j].str, HLLEN - 1);
+
+          hftirc.conf.serv[i].nhighlight = n;
      }
 }
 
@@ -130,6 +249,7 @@ config_parse(void)
      config_misc();
      config_ui();
      config_ignore();
+     config_control();
      config_server();
 
      free_conf();
@@ -0,0 +1,899 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Local control socket.
+ *
+ * Clients send text lines:
+ *   .subscribe      start receiving the event feed
+ *   .unsubscribe    stop receiving it
+ *   .buffers        list buffers with the sequence number of their last line
+ *   .sync <id> <n>  send lines of buffer <id> newer than sequence number <n>
+ *   .attach <term>  take the terminal passed along (SCM_RIGHTS), see hftirc -a
+ *   .resize         the attached terminal was resized
+ *   anything else   handled by input_manage() as if typed in the input bar
+ *
+ * Only clients of our own user are accepted.
+ *
+ * Subscribers receive one JSON object per line, for example:
+ *   {"seq":12,"time":1286123456,"session":"Hft","event":"message",
+ *    "target":"#hftirc","nick":"foo","text":"hello"}
+ *
+ * Each subscriber has a bounded queue; when it is full the event is dropped
+ * (a "dropped" event tells how many were lost) or the client is
+ * disconnected, see control.overflow in the configuration.
+ */
+
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+
+#include "hftirc.h"
+
+static void control_client_close(CtlClient *c);
+static void control_flush(CtlClient *c);
+static Bool control_enqueue(CtlClient *c, const char *str, size_t len);
+static size_t control_json_str(char *buf, size_t pos, size_t size, const char *str);
+
+static int
+control_addr(struct sockaddr_un *a, socklen_t *len)
+{
+     size_t n = strlen(hftirc.conf.ctlpath);
+
+     memset(a, 0, sizeof(*a));
+     a->sun_family = AF_UNIX;
+
+     if(!n || n >= sizeof(a->sun_path))
+          return 1;
+
+     memcpy(a->sun_path, hftirc.conf.ctlpath, n);
+
+     /* "@name" -> abstract namespace socket (Linux) */
+     if(a->sun_path[0] == '@')
+          a->sun_path[0] = '\0';
+
+     *len = offsetof(struct sockaddr_un, sun_path) + n;
+
+     return 0;
+}
+
+void
+control_init(void)
+{
+     int fd;
+     struct sockaddr_un a;
+     socklen_t len;
+
+     hftirc.ctl.sock = -1;
+
+     if(!hftirc.conf.ctl)
+          return;
+
+     if(control_addr(&a, &len))
+     {
+          WARN("Error", "Invalid control socket path");
+          return;
+     }
+
+     if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+          return;
+
+     if(bind(fd, (struct sockaddr*)&a, len) < 0)
+     {
+          /* Stale socket from a dead process: reuse it */
+          if(errno == EADDRINUSE && a.sun_path[0]
+                    && connect(fd, (struct sockaddr*)&a, len) < 0
+                    && errno == ECONNREFUSED)
+          {
+               close(fd);
+               unlink(a.sun_path);
+
+               if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+                    return;
+
+               if(bind(fd, (struct sockaddr*)&a, len) == 0)
+                    goto bound;
+          }
+
+          ui_print_buf(hftirc.statuscb, "[HFTIrc] *** Can't bind control socket %s: %s",
+                    hftirc.conf.ctlpath, strerror(errno));
+          close(fd);
+
+          return;
+     }
+
+bound:
+     if(a.sun_path[0])
+          chmod(a.sun_path, S_IRUSR | S_IWUSR);
+
+     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+     fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+     if(listen(fd, 8) < 0)
+     {
+          close(fd);
+          return;
+     }
+
+     hftirc.ctl.sock = fd;
+
+     return;
+}
+
+void
+control_close(void)
+{
+     while(hftirc.ctl.head)
+          control_client_close(hftirc.ctl.head);
+
+     if(hftirc.ctl.sock < 0)
+          return;
+
+     close(hftirc.ctl.sock);
+     hftirc.ctl.sock = -1;
+
+     if(hftirc.conf.ctlpath[0] != '@')
+          unlink(hftirc.conf.ctlpath);
+
+     return;
+}
+
+/* Add control fds to select() sets */
+void
+control_set_fds(fd_set *iset, fd_set *oset, int *maxfd)
+{
+     CtlClient *c;
+
+     if(hftirc.ctl.sock < 0)
+          return;
+
+     FD_SET(hftirc.ctl.sock, iset);
+
+     if(*maxfd < hftirc.ctl.sock)
+          *maxfd = hftirc.ctl.sock;
+
+     for(c = hftirc.ctl.head; c; c = c->next)
+     {
+          FD_SET(c->fd, iset);
+
+          if(c->qlen)
+               FD_SET(c->fd, oset);
+
+          if(*maxfd < c->fd)
+               *maxfd = c->fd;
+     }
+
+     return;
+}
+
+static void
+control_client_close(CtlClient *c)
+{
+     if(c->subscribed)
+          --hftirc.ctl.nsub;
+
+     /* Attached client gone: its terminal is not ours anymore */
+     if(c->attach)
+     {
+          c->attach = False;
+          ui_detach();
+     }
+
+     if(c->fds[0] >= 0)
+          close(c->fds[0]);
+     if(c->fds[1] >= 0)
+          close(c->fds[1]);
+
+     close(c->fd);
+     free(c->queue);
+
+     if(c->prev)
+          c->prev->next = c->next;
+     else
+          hftirc.ctl.head = c->next;
+
+     if(c->next)
+          c->next->prev = c->prev;
+
+     free(c);
+
+     return;
+}
+
+/* Only our user: an abstract socket ("@name") has no file mode */
+static Bool
+control_peer_ok(int fd)
+{
+#ifdef SO_PEERCRED
+     struct ucred cr;
+     socklen_t len = sizeof(cr);
+
+     return (!getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) && cr.uid == getuid());
+#else
+     uid_t uid;
+     gid_t gid;
+
+     return (!getpeereid(fd, &uid, &gid) && uid == getuid());
+#endif /* SO_PEERCRED */
+}
+
+static void
+control_accept(void)
+{
+     int fd;
+     CtlClient *c;
+
+     if((fd = accept(hftirc.ctl.sock, NULL, NULL)) < 0)
+          return;
+
+     if(!control_peer_ok(fd))
+     {
+          close(fd);
+          return;
+     }
+
+     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+     fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+     c = xcalloc(1, sizeof(CtlClient));
+     c->fd = fd;
+     c->fds[0] = c->fds[1] = -1;
+
+     HFTLIST_ATTACH(hftirc.ctl.head, c);
+
+     return;
+}
+
+/* Output queue is only allocated for clients that need it */
+static void
+control_queue_alloc(CtlClient *c)
+{
+     if(c->queue)
+          return;
+
+     c->queue = xmalloc(hftirc.conf.ctlqueue, 1);
+     c->qhead = c->qlen = 0;
+
+     return;
+}
+
+static Bool
+control_reply(CtlClient *c, const char *str, size_t len)
+{
+     control_queue_alloc(c);
+
+     return control_enqueue(c, str, len);
+}
+
+/* List buffers, a client compares seq with the last line it saw
+ * and only syncs the buffers that changed */
+static void
+control_buffers(CtlClient *c)
+{
+     char buf[BUFSIZE];
+     size_t pos;
+     ChanBuf *cb;
+     int i;
+
+     for(i = 0; i < hftirc.nbuf && (cb = hftirc.cb[i]); ++i)
+     {
+          pos = snprintf(buf, sizeof(buf), "{\"event\":\"buffer\",\"buffer\":%d,\"seq\":%lu,\"session\":",
+                    cb->id, cb->seq);
+          pos = control_json_str(buf, pos, sizeof(buf) - 16, (cb->session ? cb->session->name : NULL));
+          pos += sprintf(buf + pos, ",\"name\":");
+          pos = control_json_str(buf, pos, sizeof(buf) - 16, cb->name);
+          pos += sprintf(buf + pos, "}\n");
+
+          control_reply(c, buf, pos);
+     }
+
+     return;
+}
+
+/* Send lines of a buffer newer than seq, as much as fits in the queue.
+ * The closing "synced" event has "more":true when the client must ask again
+ * from the returned seq.
+ */
+static void
+control_sync(CtlClient *c, char *arg)
+{
+     char buf[BUFFERSIZE + 256], line[BUFFERSIZE];
+     unsigned long seq, last;
+     size_t pos, len;
+     int i, more = 0;
+     unsigned int n, lo, hi;
+     ChanBuf *cb;
+     ScrollLine *l;
+
+     if(sscanf(arg, "%d %lu", &i, &seq) != 2 || !(cb = find_buf_wid(i)))
+     {
+          pos = sprintf(buf, "{\"event\":\"error\",\"text\":\"usage: .sync <buffer> <seq>\"}\n");
+          control_reply(c, buf, pos);
+          return;
+     }
+
+     last = seq;
+
+     /* First line newer than seq: seq grows along the scrollback and
+      * scroll_line() is direct, spilled lines included (NULL when the
+      * spill can't be read) */
+     for(lo = 0, hi = cb->scroll.n; lo < hi;)
+     {
+          n = lo + (hi - lo) / 2;
+
+          /* Spilled line that can't be mapped */
+          if(!(l = scroll_line(&cb->scroll, n)))
+          {
+               pos = sprintf(buf, "{\"event\":\"error\",\"text\":\"scrollback unreadable\"}\n");
+               control_reply(c, buf, pos);
+               return;
+          }
+
+          if(l->seq <= seq)
+               lo = n + 1;
+          else
+               hi = n;
+     }
+
+     for(n = lo; (l = scroll_line(&cb->scroll, n)); ++n)
+     {
+          /* Formatted as displayed, without the \n */
+          if((len = ui_line_format(l, line, sizeof(line))) && line[len - 1] == '\n')
+               line[len - 1] = '\0';
+
+          pos = snprintf(buf, sizeof(buf), "{\"event\":\"line\",\"buffer\":%d,\"seq\":%lu,\"text\":",
+                    cb->id, l->seq);
+          pos = control_json_str(buf, pos, sizeof(buf) - 16, line);
+          pos += sprintf(buf + pos, "}\n");
+
+          /* Keep room for the final event */
+          if(pos + 128 > hftirc.conf.ctlqueue - c->qlen || !control_reply(c, buf, pos))
+          {
+               more = 1;
+               break;
+          }
+
+          last = l->seq;
+     }
+
+     pos = sprintf(buf, "{\"event\":\"synced\",\"buffer\":%d,\"seq\":%lu,\"more\":%s}\n",
+               cb->id, last, (more ? "true" : "false"));
+     control_reply(c, buf, pos);
+
+     return;
+}
+
+static void
+control_attach_term(CtlClient *c, char *term)
+{
+     char buf[128];
+     size_t pos;
+
+     DSINPUT(term);
+
+     if(c->fds[0] < 0 || c->fds[1] < 0)
+          pos = sprintf(buf, "{\"event\":\"error\",\"text\":\"no terminal received\"}\n");
+     else if(hftirc.ui.attached)
+          pos = sprintf(buf, "{\"event\":\"error\",\"text\":\"already attached\"}\n");
+     else if(!ui_attach(c->fds[0], c->fds[1], (strlen(term) ? term : NULL)))
+          pos = sprintf(buf, "{\"event\":\"error\",\"text\":\"can't use terminal\"}\n");
+     else
+     {
+          /* Owned by the ui now */
+          c->fds[0] = c->fds[1] = -1;
+          c->attach = True;
+
+          return;
+     }
+
+     control_reply(c, buf, pos);
+
+     return;
+}
+
+/* The ui left the terminal of an attached client: let it go */
+void
+control_detach(void)
+{
+     CtlClient *c;
+
+     for(c = hftirc.ctl.head; c; c = c->next)
+          if(c->attach)
+          {
+               c->attach = False;
+               c->dead = True;
+          }
+
+     return;
+}
+
+/* Keep the listening socket and the attached client across execve()
+ * (see upgrade_exec()), other clients are closed on exec.
+ * Return the attached client fd, or -1.
+ */
+int
+control_upgrade(void)
+{
+     CtlClient *c;
+
+     if(hftirc.ctl.sock >= 0)
+          fcntl(hftirc.ctl.sock, F_SETFD, 0);
+
+     for(c = hftirc.ctl.head; c; c = c->next)
+          if(c->attach)
+          {
+               control_flush(c);
+               fcntl(c->fd, F_SETFD, 0);
+
+               return c->fd;
+          }
+
+     return -1;
+}
+
+/* The exec of an upgrade failed: what control_upgrade() let through
+ * is closed on exec again */
+void
+control_upgrade_cancel(void)
+{
+     CtlClient *c;
+
+     if(hftirc.ctl.sock >= 0)
+          fcntl(hftirc.ctl.sock, F_SETFD, FD_CLOEXEC);
+
+     for(c = hftirc.ctl.head; c; c = c->next)
+          if(c->attach)
+               fcntl(c->fd, F_SETFD, FD_CLOEXEC);
+
+     return;
+}
+
+/* Take back the control socket and attached client after an upgrade */
+void
+control_restore(int sock, int cfd, int infd, int outfd, const char *term)
+{
+     CtlClient *c;
+
+     if((hftirc.ctl.sock = sock) >= 0)
+          fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+     if(cfd < 0)
+          return;
+
+     fcntl(cfd, F_SETFD, FD_CLOEXEC);
+     fcntl(infd, F_SETFD, FD_CLOEXEC);
+     fcntl(outfd, F_SETFD, FD_CLOEXEC);
+
+     c = xcalloc(1, sizeof(CtlClient));
+     c->fd = cfd;
+     c->fds[0] = c->fds[1] = -1;
+
+     HFTLIST_ATTACH(hftirc.ctl.head, c);
+
+     if(ui_attach(infd, outfd, ((term && strlen(term)) ? term : NULL)))
+          c->attach = True;
+     else
+          c->dead = True;
+
+     return;
+}
+
+static void
+control_resize(CtlClient *c)
+{
+     struct winsize ws;
+
+     if(c->attach && ioctl(fileno(hftirc.ui.out), TIOCGWINSZ, &ws) == 0)
+          ui_resize(ws.ws_row, ws.ws_col);
+
+     return;
+}
+
+/* Execute one line received from a client */
+static void
+control_line(CtlClient *c, char *line)
+{
+     if(!strcmp(line, ".subscribe"))
+     {
+          if(!c->subscribed)
+          {
+               c->subscribed = True;
+               ++hftirc.ctl.nsub;
+          }
+     }
+     else if(!strcmp(line, ".unsubscribe"))
+     {
+          if(c->subscribed)
+          {
+               c->subscribed = False;
+               --hftirc.ctl.nsub;
+          }
+     }
+     else if(!strcmp(line, ".buffers"))
+          control_buffers(c);
+     else if(!strncmp(line, ".sync ", 6))
+          control_sync(c, line + 6);
+     else if(!strncmp(line, ".attach", 7))
+          control_attach_term(c, line + 7);
+     else if(!strcmp(line, ".resize"))
+          control_resize(c);
+     else if(strlen(line))
+          input_manage(line);
+
+     return;
+}
+
+/* Read a batch of lines from a client, return non zero on EOF/error */
+static int
+control_read(CtlClient *c)
+{
+     int length, i, *fds;
+     char *p, *eol;
+     struct msghdr msg;
+     struct iovec iov;
+     struct cmsghdr *cmsg;
+     union { struct cmsghdr h; char buf[CMSG_SPACE(2 * sizeof(int))]; } cm;
+
+     iov.iov_base = c->inbuf + c->inoffset;
+     iov.iov_len = sizeof(c->inbuf) - 1 - c->inoffset;
+
+     memset(&msg, 0, sizeof(msg));
+     msg.msg_iov = &iov;
+     msg.msg_iovlen = 1;
+     msg.msg_control = cm.buf;
+     msg.msg_controllen = sizeof(cm.buf);
+
+     length = recvmsg(c->fd, &msg, 0);
+
+     if(length <= 0)
+          return !(length < 0 && (errno == EAGAIN || errno == EINTR));
+
+     /* Terminal fds sent by hftirc -a */
+     for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+          if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+          {
+               fds = (int*)CMSG_DATA(cmsg);
+
+               for(i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); ++i)
+               {
+                    if(i < 2 && c->fds[i] < 0)
+                    {
+                         c->fds[i] = fds[i];
+                         fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+                    }
+                    else
+                         close(fds[i]);
+               }
+          }
+
+     c->inoffset += length;
+     c->inbuf[c->inoffset] = '\0';
+
+     for(p = c->inbuf; (eol = strchr(p, '\n')); p = eol + 1)
+     {
+          *eol = '\0';
+
+          if(eol > p && eol[-1] == '\r')
+               eol[-1] = '\0';
+
+          control_line(c, p);
+     }
+
+     c->inoffset -= p - c->inbuf;
+     memmove(c->inbuf, p, c->inoffset);
+
+     /* Line too long: drop it */
+     if(c->inoffset >= sizeof(c->inbuf) - 1)
+          c->inoffset = 0;
+
+     return 0;
+}
+
+void
+control_process(fd_set *iset, fd_set *oset)
+{
+     CtlClient *c, *next;
+
+     if(hftirc.ctl.sock < 0)
+          return;
+
+     for(c = hftirc.ctl.head; c; c = c->next)
+          if(!c->dead && FD_ISSET(c->fd, iset) && control_read(c))
+               c->dead = True;
+          else if(!c->dead && FD_ISSET(c->fd, oset))
+               control_flush(c);
+
+     /* Clients are only freed here, commands they sent may have
+      * caused other clients to be dropped while we were iterating */
+     for(c = hftirc.ctl.head; c; c = next)
+     {
+          next = c->next;
+
+          if(c->dead)
+               control_client_close(c);
+     }
+
+     if(FD_ISSET(hftirc.ctl.sock, iset))
+          control_accept();
+
+     return;
+}
+
+/* Write as much queued data as the socket takes without blocking */
+static void
+control_flush(CtlClient *c)
+{
+     ssize_t n;
+     size_t len;
+
+     while(c->qlen)
+     {
+          len = hftirc.conf.ctlqueue - c->qhead;
+
+          if(len > c->qlen)
+               len = c->qlen;
+
+          if((n = write(c->fd, c->queue + c->qhead, len)) <= 0)
+               break;
+
+          c->qhead = (c->qhead + n) % hftirc.conf.ctlqueue;
+          c->qlen -= n;
+     }
+
+     if(!c->qlen)
+          c->qhead = 0;
+
+     return;
+}
+
+static Bool
+control_enqueue(CtlClient *c, const char *str, size_t len)
+{
+     size_t tail, n;
+
+     if(len > hftirc.conf.ctlqueue - c->qlen)
+          return False;
+
+     tail = (c->qhead + c->qlen) % hftirc.conf.ctlqueue;
+     n = hftirc.conf.ctlqueue - tail;
+
+     if(n > len)
+          n = len;
+
+     memcpy(c->queue + tail, str, n);
+     memcpy(c->queue, str + n, len - n);
+     c->qlen += len;
+
+     return True;
+}
+
+/* Append str to buf as a JSON string, cut to stay under size; the
+ * quotes are always there when pos + 2 <= size, and a UTF-8 sequence
+ * goes whole or not at all.
+ */
+static size_t
+control_json_str(char *buf, size_t pos, size_t size, const char *str)
+{
+     const unsigned char *s;
+     int n;
+
+     if(pos < size)
+          buf[pos++] = '"';
+
+     for(s = (const unsigned char*)(str ? str : ""); *s && pos + 7 < size; ++s)
+     {
+          if(*s == '"' || *s == '\\')
+          {
+               buf[pos++] = '\\';
+               buf[pos++] = *s;
+          }
+          else if(*s < 0x20)
+               pos += sprintf(buf + pos, "\\u%04x", *s);
+          else
+          {
+               buf[pos++] = *s;
+
+               /* Continuation bytes of a lead byte, 4 bytes at most */
+               if(*s >= 0xC0)
+                    for(n = 0; n < 3 && (s[1] & 0xC0) == 0x80; ++n)
+                         buf[pos++] = *++s;
+          }
+     }
+
+     if(pos < size)
+          buf[pos++] = '"';
+
+     return pos;
+}
+
+/* Broadcast a parsed event to subscribers.
+ * Arguments after kind are key/value string pairs, terminated by NULL.
+ */
+void
+control_event(IrcSession *session, const char *kind, ...)
+{
+     va_list ap;
+     char buf[BUFSIZE * 2], drop[64];
+     const char *key;
+     size_t pos, max = sizeof(buf) - 16;
+     int n;
+     CtlClient *c;
+
+     if(!hftirc.ctl.nsub)
+          return;
+
+     pos = snprintf(buf, sizeof(buf), "{\"seq\":%lu,\"time\":%ld,\"session\":",
+               ++hftirc.ctl.seq, (long)time(NULL));
+     pos = control_json_str(buf, pos, max, (session ? session->name : NULL));
+     pos += sprintf(buf + pos, ",\"event\":");
+     pos = control_json_str(buf, pos, max, kind);
+
+     va_start(ap, kind);
+
+     /* Values are truncated to fit; a key goes only with room for
+      * ,"key":"" so that the object stays valid */
+     while((key = va_arg(ap, const char*)) && pos + strlen(key) + 6 < max)
+     {
+          buf[pos++] = ',';
+          pos = control_json_str(buf, pos, max, key);
+          buf[pos++] = ':';
+          pos = control_json_str(buf, pos, max, va_arg(ap, const char*));
+     }
+
+     va_end(ap);
+
+     buf[pos++] = '}';
+     buf[pos++] = '\n';
+
+     for(c = hftirc.ctl.head; c; c = c->next)
+     {
+          if(!c->subscribed || c->dead)
+               continue;
+
+          control_queue_alloc(c);
+
+          /* Tell the client it lost events as soon as there is room */
+          if(c->dropped)
+          {
+               n = snprintf(drop, sizeof(drop), "{\"event\":\"dropped\",\"count\":%u}\n", c->dropped);
+
+               if(control_enqueue(c, drop, n))
+                    c->dropped = 0;
+          }
+
+          if(c->dropped || !control_enqueue(c, buf, pos))
+          {
+               if(!hftirc.conf.ctldrop)
+               {
+                    c->dead = True;
+                    continue;
+               }
+
+               ++c->dropped;
+          }
+
+          control_flush(c);
+     }
+
+     return;
+}
+
+static volatile sig_atomic_t attach_resized = 0;
+
+static void
+control_attach_winch(int sig)
+{
+     attach_resized = 1;
+
+     return;
+}
+
+/* hftirc -a: give our terminal to the running HFTIrc through the control
+ * socket and wait until it detaches (or quits).
+ */
+int
+control_attach(void)
+{
+     int fd, ret = EXIT_SUCCESS, fds[2] = { STDIN_FILENO, STDOUT_FILENO };
+     char line[128], buf[BUFSIZE];
+     ssize_t n;
+     fd_set set;
+     struct sockaddr_un a;
+     socklen_t len;
+     struct msghdr msg;
+     struct iovec iov;
+     struct cmsghdr *cmsg;
+     struct termios tio;
+     struct sigaction sig;
+     union { struct cmsghdr h; char buf[CMSG_SPACE(2 * sizeof(int))]; } cm;
+
+     if(!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+          errx(EXIT_FAILURE, "not a terminal");
+
+     if(control_addr(&a, &len))
+          errx(EXIT_FAILURE, "invalid control socket path");
+
+     if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+               || connect(fd, (struct sockaddr*)&a, len) < 0)
+          err(EXIT_FAILURE, "%s", hftirc.conf.ctlpath);
+
+     snprintf(line, sizeof(line), ".attach %s\n", (getenv("TERM") ? getenv("TERM") : ""));
+
+     iov.iov_base = line;
+     iov.iov_len = strlen(line);
+
+     memset(&msg, 0, sizeof(msg));
+     msg.msg_iov = &iov;
+     msg.msg_iovlen = 1;
+     msg.msg_control = cm.buf;
+     msg.msg_controllen = sizeof(cm.buf);
+
+     cmsg = CMSG_FIRSTHDR(&msg);
+     cmsg->cmsg_level = SOL_SOCKET;
+     cmsg->cmsg_type = SCM_RIGHTS;
+     cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+     memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+     tcgetattr(STDIN_FILENO, &tio);
+
+     if(sendmsg(fd, &msg, 0) < 0)
+          err(EXIT_FAILURE, "sendmsg");
+
+     /* Resize is only seen by us, forward it */
+     memset(&sig, 0, sizeof(sig));
+     sig.sa_handler = control_attach_winch;
+     sigaction(SIGWINCH, &sig, NULL);
+
+     for(;;)
+     {
+          if(attach_resized)
+          {
+               attach_resized = 0;
+               write(fd, ".resize\n", 8);
+          }
+
+          FD_ZERO(&set);
+          FD_SET(fd, &set);
+
+          if(select(fd + 1, &set, NULL, NULL, NULL) < 0)
+          {
+               if(errno == EINTR)
+                    continue;
+               break;
+          }
+
+          if((n = read(fd, buf, sizeof(buf) - 1)) <= 0)
+               break;
+
+          /* Only errors are sent to us */
+          buf[n] = '\0';
+          fprintf(stderr, "hftirc: %s", buf);
+
+          if(strstr(buf, "\"error\""))
+          {
+               ret = EXIT_FAILURE;
+               break;
+          }
+     }
+
+     /* The terminal may have been left in raw mode if HFTIrc died */
+     tcsetattr(STDIN_FILENO, TCSANOW, &tio);
+     close(fd);
+
+     return ret;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Input line editor.
+ *
+ * The line is a gap buffer: the characters before the cursor start
+ * buf, the tail ones (after it) end buf, and the gap between them is
+ * where typing goes.  Moving the cursor carries one character over the
+ * gap, typing and erasing only move the gap ends.  The display width of each
+ * character (2 for a ^X control key, 2 for a wide one) is kept with it,
+ * so is the column of the cursor.
+ *
+ * The line scrolls by half a screen when the cursor goes out of sight.
+ * An edit draws again from its column to the end of the line, a move
+ * only the old and new cells of the cursor.
+ */
+
+#include "hftirc.h"
+#include "ui.h"
+
+/* Character i of the line */
+#define EDITAT(ib, i) ((i) < (ib)->gap ? (i) : (i) + BUFSIZE - (ib)->tail - (ib)->gap)
+
+static int
+edit_width(wchar_t c)
+{
+     int w;
+
+     /* Control keys are drawn ^X */
+     if(IS_CTRLK(c))
+          return 2;
+
+     return ((w = wcwidth(c)) < 0 ? 1 : w);
+}
+
+/* Changed from column col */
+static void
+edit_dirty(int col)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+
+     if(ib->redraw < 0 || col < ib->redraw)
+          ib->redraw = col;
+
+     return;
+}
+
+int
+edit_len(void)
+{
+     return hftirc.ui.ib.gap + hftirc.ui.ib.tail;
+}
+
+/* Text of the line in dst (size characters, nul included) */
+int
+edit_text(wchar_t *dst, int size)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+     int n = MIN(ib->gap, size - 1);
+     int m = MIN(ib->tail, size - 1 - n);
+
+     wmemcpy(dst, ib->buf, n);
+     wmemcpy(dst + n, ib->buf + BUFSIZE - ib->tail, m);
+     dst[n + m] = L'\0';
+
+     return n + m;
+}
+
+void
+edit_insert(wchar_t c)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+
+     if(edit_len() >= BUFSIZE - 1)
+          return;
+
+     edit_dirty(ib->col);
+
+     ib->buf[ib->gap] = c;
+     ib->width[ib->gap] = edit_width(c);
+     ib->col += ib->width[ib->gap];
+     ++ib->gap;
+
+     return;
+}
+
+/* n characters before the cursor, or -n after it */
+void
+edit_erase(int n)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+
+     for(; n > 0 && ib->gap; --n)
+     {
+          --ib->gap;
+          ib->col -= ib->width[ib->gap];
+     }
+
+     if(n < 0)
+          ib->tail = MAX(ib->tail + n, 0);
+
+     edit_dirty(ib->col);
+
+     return;
+}
+
+/* Word before the cursor and the spaces after it */
+void
+edit_erase_word(void)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+     int i = ib->gap;
+
+     for(; i && ib->buf[i - 1] == ' '; --i);
+     for(; i && ib->buf[i - 1] != ' '; --i);
+
+     edit_erase(ib->gap - i);
+
+     return;
+}
+
+/* Cursor n characters right, or -n left */
+void
+edit_move(int n)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+
+     int e;
+
+     for(; n < 0 && ib->gap; ++n)
+     {
+          e = BUFSIZE - ++ib->tail;
+          --ib->gap;
+          ib->buf[e] = ib->buf[ib->gap];
+          ib->width[e] = ib->width[ib->gap];
+          ib->col -= ib->width[e];
+     }
+
+     for(; n > 0 && ib->tail; --n)
+     {
+          e = BUFSIZE - ib->tail--;
+          ib->buf[ib->gap] = ib->buf[e];
+          ib->width[ib->gap] = ib->width[e];
+          ib->col += ib->width[ib->gap];
+          ++ib->gap;
+     }
+
+     return;
+}
+
+/* Line set to s, cursor at its end */
+void
+edit_set(const wchar_t *s)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+
+     ib->gap = ib->tail = ib->col = 0;
+
+     for(; *s; ++s)
+          edit_insert(*s);
+
+     edit_redraw();
+
+     return;
+}
+
+/* All of it to be drawn, as in a new window.  Widths are measured
+ * again: the line may come from before the locale was set (/upgrade).
+ */
+void
+edit_redraw(void)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+     int i;
+
+     for(i = ib->col = 0; i < edit_len(); ++i)
+     {
+          ib->width[EDITAT(ib, i)] = edit_width(ib->buf[EDITAT(ib, i)]);
+
+          if(i < ib->gap)
+               ib->col += ib->width[i];
+     }
+
+     ib->scroll = ib->first = 0;
+     ib->redraw = 0;
+     ib->curs = -1;
+
+     return;
+}
+
+/* Character at column col (on the screen), its column in *x */
+static int
+edit_at_col(int col, int *x)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+     int i, c;
+
+     for(i = ib->first, c = ib->scroll; i < edit_len()
+               && c + ib->width[EDITAT(ib, i)] <= col; ++i)
+          c += ib->width[EDITAT(ib, i)];
+
+     *x = c;
+
+     return i;
+}
+
+/* Draw character i (or the blank after the line) at the current position */
+static void
+edit_put(int i, unsigned int mask)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+     wchar_t c = (i < edit_len() ? ib->buf[EDITAT(ib, i)] : L' ');
+
+     wattron(hftirc.ui.inputwin, mask);
+     waddnwstr(hftirc.ui.inputwin, &c, 1);
+     wattroff(hftirc.ui.inputwin, mask);
+
+     return;
+}
+
+/* Draw what changed since the last time */
+void
+edit_draw(void)
+{
+     InputBuf *ib = &hftirc.ui.ib;
+     WINDOW *w = hftirc.ui.inputwin;
+     int i, x, c;
+
+     if(!hftirc.ui.attached)
+          return;
+
+     /* Cursor out of sight (it takes up to 2 cells): half a screen
+      * before it in sight */
+     if(ib->col < ib->scroll || ib->col > ib->scroll + COLS - 2)
+     {
+          c = MAX(0, ib->col - COLS / 2);
+
+          for(; ib->first && ib->scroll > c; --ib->first)
+               ib->scroll -= ib->width[EDITAT(ib, ib->first - 1)];
+
+          for(; ib->first < edit_len() && ib->scroll + ib->width[EDITAT(ib, ib->first)] <= c; ++ib->first)
+               ib->scroll += ib->width[EDITAT(ib, ib->first)];
+
+          ib->redraw = ib->scroll;
+          ib->curs = -1;
+     }
+
+     if(ib->redraw < 0 && ib->curs == ib->col)
+          return;
+
+     /* Text from the first change to the end of the window */
+     if(ib->redraw >= 0)
+     {
+          i = edit_at_col(MAX(ib->redraw, ib->scroll), &x);
+          wmove(w, 0, x - ib->scroll);
+          wclrtoeol(w);
+
+          for(; i < edit_len() && x + ib->width[EDITAT(ib, i)] <= ib->scroll + COLS; ++i)
+          {
+               edit_put(i, A_NORMAL);
+               x += ib->width[EDITAT(ib, i)];
+          }
+
+          if(ib->curs >= ib->redraw)
+               ib->curs = -1;
+     }
+
+     /* Cell the cursor left */
+     if(ib->curs >= 0 && ib->curs != ib->col && ib->curs < ib->scroll + COLS)
+     {
+          i = edit_at_col(ib->curs, &x);
+          wmove(w, 0, x - ib->scroll);
+          edit_put(i, A_NORMAL);
+     }
+
+     wmove(w, 0, ib->col - ib->scroll);
+     edit_put(ib->gap, A_REVERSE);
+
+     ib->redraw = -1;
+     ib->curs = ib->col;
+     hftirc.ui.dirty |= WInput;
+
+     return;
+}
@@ -48,12 +48,17 @@ event_numeric(IrcSession *session, unsigned int event, const char *origin, const
 
      switch(event)
      {
+          /* RPL_ISUPPORT: keep CASEMAPPING, and show it as the others */
+          case 5:
+               for(i = 1; i < count; ++i)
+                    if(!strncmp(params[i], "CASEMAPPING=", 12))
+                         irc_casemap(session, params[i] + 12);
+
           /* Basic message, just write it in status buffer */
           case 1:
           case 2:
           case 3:
           case 4:
-          case 5:
           case 250:
           case 251:
           case 252:
@@ -178,7 +183,12 @@ event_numeric(IrcSession *session, unsigned int event, const char *origin, const
                          session->name, B, params[1], B, B, params[2]);
 
                if((cb = find_buf(session, params[1])) != hftirc.statuscb)
+               {
+                    buf_hash_del(cb);
                     strcpy(cb->name, params[2]);
+                    buf_hash_add(cb);
+                    hftirc.ui.statusmod = True;
+               }
 
                break;
 
@@ -195,7 +205,7 @@ event_numeric(IrcSession *session, unsigned int event, const char *origin, const
           case 376:
                /* Re-join every channel opened previously in the same session */
                if(session->motd_received)
-                    for(cb = hftirc.cbhead; cb; cb = cb->next)
+                    for(i = 0; i < hftirc.nbuf && (cb = hftirc.cb[i]); ++i)
                          if(cb->session == session && ISCHAN(cb->name[0]))
                               irc_send_raw(session, "JOIN %s", cb->name);
 
@@ -215,32 +225,40 @@ event_nick(IrcSession *session, const char *event, const char *origin, const cha
      int i;
      char nick[NICKLEN] = { 0 };
      NickStruct *ns;
+     IrcUser *u;
      ChanBuf *cb;
 
      if(origin && strchr(origin, '!'))
           for(i = 0; origin[i] != '!'; nick[i] = origin[i], ++i);
 
-     for(cb = hftirc.cbhead; cb; cb = cb->next)
-          for(ns = cb->nickhead; ns; ns = ns->next)
-               if(cb->session == session && ns->nick && !strcmp(nick, ns->nick))
-               {
-                    cb->umask |= (UNickSortMask | UNickListMask);
+     control_event(session, "nick", "nick", nick, "new", params[0], NULL);
 
-                    if(!strcmp(nick, session->nick))
-                         strcpy(session->nick, params[0]);
+     if(!strcmp(nick, session->nick))
+     {
+          free(session->nick);
+          session->nick = strdup(params[0]);
+          hftirc.ui.statusmod = True;
+     }
 
-                    if(!(hftirc.conf.ignore & IgnoreNick))
-                         ui_print_buf(cb, "  *** %s is now %c%s", nick, B, params[0]);
-                    
-                    strcpy(ns->nick, params[0]);
-               }
+     /* Only the channels of the user */
+     if((u = user_find(session, nick)))
+     {
+          if(!(hftirc.conf.ignore & IgnoreNick))
+               for(ns = u->chans; ns; ns = ns->unext)
+                    ui_print_buf(ns->cb, "  *** %s is now %c%s", nick, B, params[0]);
 
-     for(cb = hftirc.cbhead; cb; cb = cb->next)
-          if(!strcmp(nick, cb->name) && session == cb->session)
-          {
-               strcpy(cb->name, params[0]);
-               cb->umask |= (UNickSortMask | UNickListMask);
-          }
+          user_rename(session, u, params[0]);
+     }
+
+     /* Query buffer */
+     if((cb = find_buf(session, nick)) != hftirc.statuscb)
+     {
+          buf_hash_del(cb);
+          strcpy(cb->name, params[0]);
+          buf_hash_add(cb);
+          hftirc.ui.statusmod = True;
+          cb->umask |= UNickListMask;
+     }
 
      return;
 }
@@ -263,11 +281,15 @@ event_mode(IrcSession *session, const char *event, const char *origin, const cha
      /* User mode */
      if(count == 1)
      {
+          control_event(session, "mode", "target", session->nick, "nick", nick,
+                    "mode", params[0], NULL);
+
           if(!(hftirc.conf.ignore & IgnoreMode))
                ui_print_buf(hftirc.statuscb, "[%s] *** User mode of %c%s%c : [%s]",
                          session->name, B, nick, B, params[0]);
 
           session->mode = strdup(params[0]);
+          hftirc.ui.statusmod = True;
 
           return;
      }
@@ -278,27 +300,25 @@ event_mode(IrcSession *session, const char *event, const char *origin, const cha
           strcat(nicks, params[i]);
      }
 
+     control_event(session, "mode", "target", params[0], "nick", nick,
+               "mode", params[1], "args", nicks + 1, NULL);
+
      cb = find_buf(session, params[0]);
 
-     for(ns = cb->nickhead; ns; ns = ns->next)
-          if(!strcasecmp(nicks + 1, ns->nick))
+     if((ns = nick_find(cb, nicks + 1)))
+          switch(r[1])
           {
-               switch(r[1])
-               {
-                    case 'o':
-                         ns->rang = (r[0] == '+') ? '@' : '\0';
-                         break;
-                    case 'v':
-                         ns->rang = (r[0] == '+') ? '+' : '\0';
-                         break;
-                    case 'h':
-                         ns->rang = (r[0] == '+') ? '%' : '\0';
-                         break;
-                    default:
-                         break;
-               }
-
-               break;
+               case 'o':
+                    nick_set_rang(cb, ns, (r[0] == '+') ? '@' : '\0');
+                    break;
+               case 'v':
+                    nick_set_rang(cb, ns, (r[0] == '+') ? '+' : '\0');
+                    break;
+               case 'h':
+                    nick_set_rang(cb, ns, (r[0] == '+') ? '%' : '\0');
+                    break;
+               default:
+                    break;
           }
 
      if(!(hftirc.conf.ignore & IgnoreMode))
@@ -319,6 +339,7 @@ event_connect(IrcSession *session, const char *event, const char *origin, const
      event_numeric(session, 123456, origin, params, count);
 
      hftirc.selsession = session;
+     hftirc.ui.statusmod = True;
 
      /* Find session by name for autojoin */
      for(i = 0; i < hftirc.conf.nserv; ++i)
@@ -360,13 +381,15 @@ event_join(IrcSession *session, const char *event, const char *origin, const cha
           }
      }
 
+     control_event(session, "join", "channel", params[0], "nick", nick,
+               "host", origin + strlen(nick) + 1, NULL);
+
      if(!(hftirc.conf.ignore & IgnoreJoin))
           ui_print_buf(cb, "  %s %c%s%c (%s) has joined %c%s", colorstr(Green, "->>>>"),
                     B, nick, B, origin + strlen(nick) + 1, B, params[0]);
 
-     ns = nickstruct_set(nick);
-
-     nick_attach(cb, ns);
+     if((ns = nick_attach(cb, nick, '\0')))
+          user_origin(ns->user, origin);
 
      return;
 }
@@ -377,7 +400,6 @@ event_part(IrcSession *session, const char *event, const char *origin, const cha
 {
      int j;
      char nick[NICKLEN] = { 0 };
-     NickStruct *ns;
      ChanBuf *cb;
 
      irc_send_raw(session, "MODE %s +i", session->nick);
@@ -387,9 +409,10 @@ event_part(IrcSession *session, const char *event, const char *origin, const cha
      if(origin && strchr(origin, '!'))
           for(j = 0; origin[j] != '!'; nick[j] = origin[j], ++j);
 
-     for(ns = cb->nickhead; ns; ns = ns->next)
-          if(ns->nick && strlen(ns->nick) && !strcmp(ns->nick, nick))
-               nick_detach(cb, ns);
+     nick_detach(cb, nick_find(cb, nick));
+
+     control_event(session, "part", "channel", params[0], "nick", nick,
+               "text", (params[1] ? params[1] : ""), NULL);
 
      if(!(hftirc.conf.ignore & IgnorePart))
           ui_print_buf(cb,"  %s %s (%s) has left %c%s%c [%s]", colorstr(Red, "<<<<-"),
@@ -403,24 +426,28 @@ event_quit(IrcSession *session, const char *event, const char *origin, const cha
 {
      int i;
      char nick[NICKLEN] = { 0 };
-     NickStruct *ns;
-     ChanBuf *cb;
+     NickStruct *ns, *next;
+     IrcUser *u;
 
      if(origin && strchr(origin, '!'))
           for(i = 0; origin[i] != '!'; nick[i] = origin[i], ++i);
 
-     for(cb = hftirc.cbhead; cb; cb = cb->next)
-          for(ns = cb->nickhead; ns; ns = ns->next)
-          {
-               if(cb->session == session && strlen(ns->nick) && !strcmp(nick, ns->nick))
-               {
-                    if(!(hftirc.conf.ignore & IgnoreQuit))
-                         ui_print_buf(cb, "  %s %s (%s) has quit [%s]", colorstr(LightRed, "<<<<-"),
-                                   nick, origin + strlen(nick) + 1, params[0]);
-                    nick_detach(cb, ns);
-                    break;
-               }
-          }
+     control_event(session, "quit", "nick", nick, "text", params[0], NULL);
+
+     if(!(u = user_find(session, nick)))
+          return;
+
+     /* The user goes with its last channel */
+     for(ns = u->chans; ns; ns = next)
+     {
+          next = ns->unext;
+
+          if(!(hftirc.conf.ignore & IgnoreQuit))
+               ui_print_buf(ns->cb, "  %s %s (%s) has quit [%s]", colorstr(LightRed, "<<<<-"),
+                         nick, origin + strlen(nick) + 1, params[0]);
+
+          nick_detach(ns->cb, ns);
+     }
 
      return;
 }
@@ -428,8 +455,8 @@ event_quit(IrcSession *session, const char *event, const char *origin, const cha
 void
 event_channel(IrcSession *session, const char *event, const char *origin, const char **params, unsigned int count)
 {
-     int j, color = 0;
-     char r, nick[NICKLEN] = { 0 };
+     int j, col, hl = 0;
+     char r = '\0', nick[NICKLEN] = { 0 };
      NickStruct *ns;
      ChanBuf *cb;
 
@@ -442,30 +469,31 @@ event_channel(IrcSession *session, const char *event, const char *origin, const
      if(origin && strchr(origin, '!'))
           for(j = 0; origin[j] != '!'; nick[j] = origin[j], ++j);
 
-     /* Find nick in linked list of chan to find rang */
-     for(ns = cb->nickhead; ns; ns = ns->next)
-          if(!strcasecmp(nick, ns->nick))
-          {
-               r = ns->rang;
-               break;
-          }
+     control_event(session, "message", "target", params[0], "nick", nick, "text", params[1], NULL);
 
-     if(hftirc.conf.serv && strstr(params[1], session->nick))
+     /* Rang of the nick on the channel, and its color */
+     if((ns = nick_find(cb, nick)))
+     {
+          r = ns->rang;
+          col = ns->user->color;
+     }
+     else
+          col = nick_colornum(nick);
+
+     /* Highlight: whole line in yellow, else colored nick (no colors conflicts) */
+     if(highlight_match(session, params[1]))
      {
           if(hftirc.conf.bell)
                putchar('\a');
 
-          /* 8 -> Yellow for HL, see struct irccolor ui.c */
-          color = LightYellow;
+          hl = 1;
      }
-     /* Enable nick_color if there is no hl -> no colors conflicts */
-     else
-          strcpy(nick, nick_color(nick));
 
-     if(!ns->rang)
-          ui_print_buf(cb, "%s", colorstr(color, "<%s> %s", nick, params[1]));
-     else
-          ui_print_buf(cb, "%s", colorstr(color, "<%c%c%c%s> %s", B, r, B, nick, params[1]));
+     ui_print_msg(cb, (hl ? LineHl : LineMsg), r, col, nick, params[1]);
+
+     /* Last to speak, first to complete */
+     if(ns)
+          ns->seq = cb->seq;
 
      return;
 }
@@ -485,11 +513,14 @@ event_privmsg(IrcSession *session, const char *event, const char *origin, const
      if((cb = find_buf(session, nick)) == hftirc.statuscb)
      {
           cb = ui_buf_new(nick, session);
-          ns = nickstruct_set(nick);
-          nick_attach(cb, ns);
+
+          if((ns = nick_attach(cb, nick, '\0')))
+               user_origin(ns->user, origin);
      }
 
-     ui_print_buf(cb, "<%s> %s", nick, params[1]);
+     control_event(session, "message", "target", params[0], "nick", nick, "text", params[1], NULL);
+
+     ui_print_msg(cb, LinePriv, 0, 0, nick, params[1]);
 
      if(hftirc.conf.bell)
           putchar('\a');
@@ -506,6 +537,9 @@ event_notice(IrcSession *session, const char *event, const char *origin, const c
      if(origin && strchr(origin, '!'))
           for(nick[0] = ' ', j = 0; origin[j] != '!'; nick[j + 1] = origin[j], ++j);
 
+     control_event(session, "notice", "target", params[0], "nick", nick + (nick[0] == ' '),
+               "text", params[1], NULL);
+
      if(!(hftirc.conf.ignore & IgnoreNotice))
           ui_print_buf(hftirc.statuscb, "[%s] ***%s (%s)- %s", session->name, nick,
                     ((origin + strlen(nick)) ? origin + strlen(nick) : nick), params[1]);
@@ -533,6 +567,7 @@ event_topic(IrcSession *session, const char *event, const char *origin, const ch
      }
      else if(!strcmp(event, "332"))
      {
+          control_event(session, "topic", "channel", params[1], "text", params[2], NULL);
           ui_print_buf(cb, "  *** Topic of %c%s%c: %s", B, params[1], B, params[2]);
           strcpy(cb->topic, params[2]);
           cb->umask |= UTopicMask;
@@ -542,6 +577,7 @@ event_topic(IrcSession *session, const char *event, const char *origin, const ch
           if(origin && strchr(origin, '!'))
                for(j = 0; origin[j] != '!'; nick[j] = origin[j], ++j);
 
+          control_event(session, "topic", "channel", params[0], "nick", nick, "text", params[1], NULL);
           ui_print_buf(cb, "  *** New topic of %c%s%c set by %c%s%c: %s", B, params[0], B, B, nick, B, params[1]);
 
           strcpy(cb->topic, params[1]);
@@ -554,7 +590,7 @@ event_topic(IrcSession *session, const char *event, const char *origin, const ch
 void
 event_names(IrcSession *session, const char *event, const char *origin, const char **params, unsigned int count)
 {
-     int i = 0;
+     int i, n, len;
      char *p, str[BUFSIZE] = { 0 };
      NickStruct *ns;
      ChanBuf *cb;
@@ -563,7 +599,13 @@ event_names(IrcSession *session, const char *event, const char *origin, const ch
 
      if(!strcmp(event, "366"))
      {
-          nick_sort_abc(cb);
+          /* The whole reply is in: sorted and indexed once */
+          if(cb->naming)
+               nick_load(cb, cb->names.buf, cb->names.n);
+
+          FREEPTR(&cb->names.buf);
+          cb->names.n = cb->names.len = cb->names.size = 0;
+          cb->naming = 0;
 
           ui_print_buf(cb, "  *** Users of %c%s%c: %c%d%c nick(s)", B, params[1], B, B, cb->nnick, B);
           ui_print_buf(cb, "%c[%c", B, B);
@@ -571,42 +613,41 @@ event_names(IrcSession *session, const char *event, const char *origin, const ch
           for(ns = cb->nickhead; ns;)
           {
                /* 10 nick per line at names */
-               for(i = 0; ns && i < 10; ns = ns->next, ++i)
-                     sprintf(str, "%s %c%c%c%s",
-                               (strlen(str) ? str : " "), B, (ns->rang) ? ns->rang : ' ', B, ns->nick);
+               for(i = 0, n = 1, str[0] = ' '; ns && i < 10; ns = ns->next, ++i)
+                    n += snprintf(str + n, sizeof(str) - n, " %c%c%c%s",
+                              B, (ns->rang ? ns->rang : ' '), B, ns->nick);
 
                ui_print_buf(cb, "%s", str);
-               memset(str, 0, sizeof(str));
           }
 
           ui_print_buf(cb, "%c]%c", B, B);
-
-          cb->naming = 0;
      }
      else
      {
           cb = find_buf(session, params[2]);
 
-          /* Empty the list */
+          /* Kept until 366, the current list stays meanwhile */
           if(!cb->naming)
+               cb->names.n = cb->names.len = 0;
+
+          for(p = strtok((char *)params[3], " "); p; p = strtok(NULL, " "))
           {
-               /* Free the entire tail queue. */
-               for(ns = cb->nickhead; ns; ns = ns->next)
-                    nick_detach(cb, ns);
-          }
+               len = strlen(p) + 1;
 
-          p = strtok((char *)params[3], " ");
+               if(cb->names.len + len > cb->names.size)
+               {
+                    while(cb->names.len + len > cb->names.size)
+                         cb->names.size = (cb->names.size ? cb->names.size * 2 : BUFSIZE);
 
-          while(p)
-          {
-               ns = nickstruct_set(p);
-               nick_attach(cb, ns);
-               p = strtok(NULL, " ");
+                    cb->names.buf = xrealloc(cb->names.buf, cb->names.size, 1);
+               }
+
+               memcpy(cb->names.buf + cb->names.len, p, len);
+               cb->names.len += len;
+               ++cb->names.n;
           }
 
           ++cb->naming;
-
-          ui_update_nicklistwin();
      }
 
      return;
@@ -615,8 +656,9 @@ event_names(IrcSession *session, const char *event, const char *origin, const ch
 void
 event_action(IrcSession *session, const char *event, const char *origin, const char **params, unsigned int count)
 {
-     int i;
+     int i, hl;
      char nick[NICKLEN] = { 0 };
+     NickStruct *ns;
      ChanBuf *cb;
 
      if(origin && strchr(origin, '!'))
@@ -625,9 +667,16 @@ event_action(IrcSession *session, const char *event, const char *origin, const c
      if((cb = find_buf(session, params[0])) == hftirc.statuscb)
           cb = find_buf(session, nick);
 
-     ui_print_buf(cb, " %c* %s%c %s", B, nick, B, params[1]);
+     control_event(session, "action", "target", params[0], "nick", nick, "text", params[1], NULL);
 
-     if(hftirc.conf.bell && hftirc.conf.serv && strstr(params[1], session->nick))
+     hl = highlight_match(session, params[1]);
+
+     ui_print_msg(cb, (hl ? LineHlAction : LineAction), 0, 0, nick, params[1]);
+
+     if((ns = nick_find(cb, nick)))
+          ns->seq = cb->seq;
+
+     if(hftirc.conf.bell && hl)
           putchar('\a');
 
      return;
@@ -639,27 +688,21 @@ event_kick(IrcSession *session, const char *event, const char *origin, const cha
      int i;
      char ornick[NICKLEN] = { 0 };
      ChanBuf *cb;
-     NickStruct *ns;
 
      if(origin && strchr(origin, '!'))
           for(i = 0; origin[i] != '!'; ornick[i] = origin[i], ++i);
 
+     control_event(session, "kick", "channel", params[0], "nick", params[1], "by", ornick,
+               "text", params[2], NULL);
+
      cb = find_buf(session, params[0]);
 
      /* You was kicked, crap. Free all nick of the channel */
      if(!strcmp(params[1], session->nick))
-     {
-          for(ns = cb->nickhead; ns; ns = ns->next)
-               nick_detach(cb, ns);
-     }
+          nick_clear(cb);
      /* Remove nick from nicklist */
      else
-          for(ns = cb->nickhead; ns; ns = ns->next)
-               if(!strcmp(params[1], ns->nick))
-               {
-                    nick_detach(cb, ns);
-                    break;
-               }
+          nick_detach(cb, nick_find(cb, params[1]));
 
      ui_print_buf(cb, "  *** %c%s%c kicked by %s from %c%s%c [%s]",
                B, params[1], B, ornick, B, params[0], B, params[2]);
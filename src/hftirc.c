@@ -26,6 +26,8 @@ signal_handler(int signal)
      {
           /* Term resize sig */
           case SIGWINCH:
+               if(!hftirc.ui.attached || !hftirc.ui.owntty)
+                    break;
 
                b[0] = LINES;
                b[1] = COLS;
@@ -49,23 +51,27 @@ int
 main(int argc, char **argv)
 {
     struct sigaction sig;
-    int i, n, maxfd = 0;
-    fd_set iset;
+    int i, n, maxfd = 0, attach = 0, upgrade = -1;
+    long frame = -1;
+    Bool input;
+    fd_set iset, oset;
     static struct timeval tv;
     IrcSession *is;
-    ChanBuf *cb;
+
+    hftirc.prog = argv[0];
 
     snprintf(hftirc.conf.path, FILENAME_MAX, "%s/"DEF_CONF, getenv("HOME"));
 
-    while((i = getopt(argc, argv, "hvc:")) != -1)
+    while((i = getopt(argc, argv, "hvac:U:")) != -1)
     {
          switch(i)
          {
               case 'h':
               default:
-                   printf("usage: %s [-hv] [-c <file>]\n"
+                   printf("usage: %s [-hva] [-c <file>]\n"
                           "   -h         Show this page\n"
                           "   -v         Show version\n"
+                          "   -a         Attach to a detached HFTIrc\n"
                           "   -c <file>  Load a configuration file\n", argv[0]);
                    exit(EXIT_SUCCESS);
                    break;
@@ -75,12 +81,27 @@ main(int argc, char **argv)
                    exit(EXIT_SUCCESS);
                    break;
 
+              case 'a':
+                   attach = 1;
+                   break;
+
               case 'c':
                    strcpy(hftirc.conf.path, optarg);
                    break;
+
+              /* Internal, see upgrade_exec() */
+              case 'U':
+                   upgrade = atoi(optarg);
+                   break;
          }
     }
 
+    if(attach)
+    {
+         config_parse();
+         return control_attach();
+    }
+
     /* Primary allocation / set */
     hftirc.ft = 1;
 
@@ -89,12 +110,25 @@ main(int argc, char **argv)
     sig.sa_flags   = 0;
     sigaction(SIGWINCH, &sig, NULL);
 
+    /* Dead control clients / servers must not kill us */
+    sig.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sig, NULL);
+
     hftirc.running = 1;
 
     config_parse();
-    ui_init();
-    update_date();
-    irc_init();
+    history_init(upgrade < 0);
+
+    if(upgrade >= 0)
+         upgrade_restore(upgrade);
+    else
+    {
+         ui_init();
+         update_date();
+         irc_init();
+         control_init();
+    }
+
     ui_refresh_curpos();
 
     while(hftirc.running)
@@ -105,11 +139,22 @@ main(int argc, char **argv)
          tv.tv_sec = 0;
          tv.tv_usec = 250000;
 
+         /* Wake up for a delayed frame */
+         if(frame >= 0 && frame < tv.tv_usec)
+              tv.tv_usec = frame;
+
+         input = False;
+
          FD_ZERO(&iset);
+         FD_ZERO(&oset);
 
-         FD_SET(STDIN_FILENO, &iset);
+         maxfd = 0;
 
-         maxfd = STDIN_FILENO;
+         if(hftirc.ui.attached)
+         {
+              FD_SET(hftirc.ui.infd, &iset);
+              maxfd = hftirc.ui.infd;
+         }
 
          for(n = 0, is = hftirc.sessionhead; is; is = is->next, ++n)
               if(is->sock > 0 && is->connected)
@@ -120,16 +165,34 @@ main(int argc, char **argv)
                    FD_SET(is->sock, &iset);
               }
 
-         if(select(maxfd + n + 1, &iset, NULL, NULL, &tv) > 0)
+         control_set_fds(&iset, &oset, &maxfd);
+
+         if((i = select(maxfd + n + 1, &iset, &oset, NULL, &tv)) > 0)
          {
-              if(FD_ISSET(STDIN_FILENO, &iset))
+              if(hftirc.ui.attached && FD_ISSET(hftirc.ui.infd, &iset))
+              {
                    ui_get_input();
+                   input = True;
+              }
               else
                   for(is = hftirc.sessionhead; is; is = is->next)
                        if(irc_run_process(is, &iset))
+                       {
                             is->connected = 0;
+                            hftirc.ui.statusmod = True;
+                       }
+         }
+         else
+         {
+              FD_ZERO(&iset);
+              FD_ZERO(&oset);
          }
 
+         control_process(&iset, &oset);
+
+         /* Lines sent, to the history file */
+         history_flush();
+
          /* Updating date */
          update_date();
 
@@ -139,17 +202,30 @@ main(int argc, char **argv)
          /* topic win and nicklist updated only if needed with umask */
          ui_update_topicwin();
          ui_update_nicklistwin();
+
+         /* Typing is shown at once, the rest once per frame */
+         frame = ui_frame(input);
     }
 
-    endwin();
+    if(hftirc.ui.attached)
+         endwin();
+
+    control_close();
+    history_close();
 
     free(hftirc.conf.serv);
 
-    for(is = hftirc.sessionhead; is; is = is->next)
-         free(is);
+    /* Buffers first, they are indexed in their session */
+    while(hftirc.nbuf > 1)
+         ui_buf_close(hftirc.cb[hftirc.nbuf - 1]);
 
-    for(cb = hftirc.cbhead; cb; cb = cb->next)
-         ui_buf_close(cb);
+    while((is = hftirc.sessionhead))
+    {
+         hftirc.sessionhead = is->next;
+         free(is->buftab);
+         free(is->usertab);
+         free(is);
+    }
 
     return 0;
 }
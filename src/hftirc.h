@@ -27,6 +27,7 @@
 
 #include <wchar.h>
 #include <wctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
@@ -39,11 +40,18 @@
 #include <err.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/queue.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <iconv.h>
+#include <regex.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
 
 /* Local headers */
 #include "config.h"
@@ -54,20 +62,34 @@
 #define MAXBUF           (0x3F)
 #define BUFLINES         (0x1FF)
 #define BUFFERSIZE       (0xFFF)
+#define SCROLLCHUNK      (BUFFERSIZE + 1)
+#define DRAWCACHE        (0x80)
+#define DRAWSPANS        (0x40)
 #define NICKLEN          (24)
 #define CHANLEN          (24)
+#define CHARSETLEN       (32)
+#define HLLEN            (64)
+#define ALIASLEN         (128)
 #define HOSTLEN          (128)
-#define HISTOLEN         (256)
+#define COMPMAX          (256)
 #define COLORMAX         (16)
 #define COLOR_THEME_DEF  (COLOR_BLUE)
 
 #define MAINWIN_LINES  (LINES - 2)
 #define DATELEN        (strlen(hftirc.date.str))
 #define DEF_CONF        ".config/hftirc/hftirc.conf"
+#define DEF_CTLSOCK     ".config/hftirc/hftirc.sock"
+#define DEF_HISTORY     ".config/hftirc/history"
 
 #define C(c)         ((c) & 037)
 #define ISCHAN(c)    ((c == '#' || c ==  '&'))
 #define LEN(x)       (sizeof(x) / sizeof(x[0]))
+#ifndef MIN
+#define MIN(a, b)    ((a) < (b) ? (a) : (b))
+#endif /* MIN */
+#ifndef MAX
+#define MAX(a, b)    ((a) > (b) ? (a) : (b))
+#endif /* MAX */
 #define WARN(t, s)   ui_print_buf(hftirc.statuscb, "%s: %s", t, s)
 #define DSINPUT(i)   for(; i && i[0] == ' '; ++i)
 
@@ -99,16 +121,6 @@ if(!hftirc.conf.nserv || !hftirc.selsession     \
      e->next = head;                 \
      head = e;                       \
 } while(0 /*CONSTCOND*/);
-#define HFTLIST_ATTACH_END(head, type, e) do {                \
-     type *last;                                              \
-     for(last = head; last && last->next; last = last->next); \
-     if(last) {                                               \
-          last->next = e;                                     \
-          cb->prev = last;                                    \
-     } else                                                   \
-          head = e;                                           \
-     e->next = NULL;                                          \
-} while(0 /*CONSTCOND*/);
 #define HFTLIST_DETACH(head, type, e) do {                \
      type **ee;                                           \
      for(ee = &head; *ee && *ee != e; ee = &(*ee)->next); \
@@ -130,9 +142,15 @@ if(!hftirc.conf.nserv || !hftirc.selsession     \
 /* Flags definition for Update need */
 #define UNoMask        (0)
 #define UTopicMask     (1 << 1) /* Need topic bar update */
-#define UNickSortMask  (1 << 2) /* Need nick list sort   */
 #define UNickListMask  (1 << 3) /* Need nicklist update  */
 
+/* Windows to put on screen at the next frame, see ui_frame() */
+#define WMain          (1 << 0)
+#define WStatus        (1 << 1)
+#define WTopic         (1 << 2)
+#define WNicklist      (1 << 3)
+#define WInput         (1 << 4)
+
 /* IngoreFlag */
 #define IgnoreJoin   (1 << 1)
 #define IgnoreQuit   (1 << 2)
@@ -149,6 +167,29 @@ typedef enum { False, True } Bool;
 #include "parse.h"
 
 /* Structures */
+
+/* iconv descriptors of a charset, see charset.c */
+typedef struct Charset Charset;
+struct Charset
+{
+     char name[CHARSETLEN];
+     iconv_t in, out;
+     Charset *next;
+};
+
+/* Highlight patterns of a session, see highlight.c */
+typedef struct
+{
+     char nick[NICKLEN];
+     /* Aho-Corasick automaton on byte classes: next[state * nclass + class] */
+     unsigned char class[256];
+     int nclass;
+     int *next, *out, *link;
+     /* Regex rules, as one alternation */
+     regex_t re;
+     Bool hasre;
+} Highlight;
+
 typedef struct IrcSession IrcSession;
 struct IrcSession
 {
@@ -164,12 +205,66 @@ struct IrcSession
      char inbuf[BUFSIZE];
      int motd_received, connected;
      unsigned int inoffset;
+     Charset *charset;
+     Highlight *hl;
+     /* Buffers by casefolded name, see find_buf() */
+     int casemap;
+     struct ChanBuf **buftab;
+     int nbuftab, nbufhash;
+     /* Users seen on the channels, see nick.c */
+     struct IrcUser **usertab;
+     int nusertab, nuser;
 
      IrcSession *next, *prev;
 };
 
+/* What the status bar shows, it's redrawn only when this changes */
+typedef struct
+{
+     char date[256];
+     char nick[NICKLEN], mode[NICKLEN];
+     char serv[HOSTLEN], name[HOSTLEN];
+     int id, tcolor;
+     Bool connected;
+     /* Active buffers by priority: level ('1' or '2') and "id:name",
+      * nul terminated */
+     char act[BUFSIZE];
+     int actlen;
+} StatusBar;
+
+/* Input line, see edit.c */
+typedef struct
+{
+     /* Gap buffer: the text is buf[0, gap) and the last tail characters
+      * of buf, the cursor is at gap; width keeps the columns of each
+      * character */
+     wchar_t buf[BUFSIZE];
+     unsigned char width[BUFSIZE];
+     int gap, tail;
+     /* Columns before the cursor, out of sight on the left (first
+      * characters) */
+     int col, scroll, first;
+     /* To draw again from column redraw (-1: nothing), cursor drawn at
+      * column curs (-1: not drawn) */
+     int redraw, curs;
+     wchar_t prev;
+     /* Line of the history shown, 0 for none */
+     int histpos;
+     unsigned int hits, found;
+     /* Ctrl-R search; line before it or before the first Tab */
+     Bool search;
+     wchar_t before[BUFSIZE];
+} InputBuf;
+
 typedef struct
 {
+     /* Terminal, NULL when detached */
+     SCREEN *screen;
+     FILE *in, *out;
+     int infd;
+     Bool attached, owntty;
+     char term[64];
+
      /* Ncurses windows */
      WINDOW *mainwin;
      WINDOW *inputwin;
@@ -177,52 +272,166 @@ typedef struct
      WINDOW *topicwin;
      WINDOW *nicklistwin;
 
+     /* Last drawn status and topic bars; statusmod when something the
+      * status bar shows changed since */
+     StatusBar status;
+     Bool statusmod;
+     char topic[BUFSIZE];
+     /* Last drawn nicklist rows ("@nick"), none for a new window */
+     char (*nickrow)[NICKLEN + 2];
+     int nnickrow;
+
+     /* Windows changed since the last frame (W*) */
+     unsigned int dirty;
+     struct timeval lastframe;
+
      int bg, c, nicklist;
+     /* Color pair of (fg + 1, bg + 1), 0 if not allocated yet */
+     int ncolors;
+     short *pairs;
      int tcolor;
      /* Input buffer struct */
-     struct
-     {
-          wchar_t buffer[BUFSIZE];
-          wchar_t histo[HISTOLEN][BUFSIZE];
-          unsigned int nhisto, histpos, hits, found;
-          wchar_t prev;
-          int pos;
-          int cpos;
-          int split;
-          int spting;
-     } ib;
+     InputBuf ib;
 } Ui;
 
-/* Nick linked list */
+/* Channel member, nick is the one of its user */
 typedef struct NickStruct NickStruct;
+typedef struct IrcUser IrcUser;
 struct NickStruct
 {
-     char nick[NICKLEN];
+     char *nick;
      char rang;
+     /* Seq of its last line here, for completion */
+     unsigned long seq;
+     IrcUser *user;
+     struct ChanBuf *cb;
+     /* Indexes of the channel, see nick.c */
+     int prio, size;
+     NickStruct *hnext, *left, *right;
 
      NickStruct *next, *prev;
+     /* Other channels of the user */
+     NickStruct *unext, *uprev;
 };
 
+/* User of a session, one for all the channels it is on */
+struct IrcUser
+{
+     char nick[NICKLEN];
+     char *user, *host;
+     int color, refs;
+     unsigned int hash;
+     NickStruct *chans;
+
+     IrcUser *hnext;
+};
+
+/* Scrollback (see scroll.c) */
+typedef struct ScrollChunk ScrollChunk;
+struct ScrollChunk
+{
+     ScrollChunk *next;
+     size_t used;
+     char data[SCROLLCHUNK];
+};
+
+/* CASEMAPPING of a server */
+enum { CaseRfc1459, CaseAscii, CaseStrict };
+
+/* Line kinds, see ui_line_format() */
+enum { LineText, LineMsg, LineHl, LineSelf, LinePriv, LineAction, LineHlAction };
+
+typedef struct
+{
+     char *nick, *text;
+     unsigned int len;
+     unsigned char nicklen;
+     char kind, rank, color;
+     time_t time;
+     unsigned long seq;
+     ScrollChunk *chunk;
+} ScrollLine;
+
+/* Lines gone out of memory: text and (offset, seq) index files */
+typedef struct
+{
+     int fd, ifd;
+     unsigned int n;
+     unsigned long size;
+     char *map;
+     unsigned long *imap;
+     size_t maplen, imaplen;
+} ScrollSpill;
+
+typedef struct
+{
+     unsigned int n;
+     /* In memory lines ring */
+     ScrollLine *line, tmp;
+     unsigned int size, first, nram;
+     size_t bytes;
+     ScrollChunk *head, *tail, *spare;
+     ScrollSpill *spill;
+} Scroll;
+
+/* Decoded line: text without control codes and its attribute runs */
+typedef struct
+{
+     unsigned short off, len;
+     attr_t attr;
+} DrawSpan;
+
+typedef struct
+{
+     unsigned long seq;
+     wchar_t *text;
+     DrawSpan *span;
+     unsigned int nspan, width;
+} DrawLine;
+
 /* Channel buffer */
 typedef struct ChanBuf ChanBuf;
 struct ChanBuf
 {
      /* For ui use */
      int id;
-     char *buffer;
-     int bufpos, scrollpos, naming;
-     int nicklistscroll, lastposbold;
+     Scroll scroll;
+     DrawLine *draw;
+     unsigned long seq, lastseen;
+     int scrollpos, naming;
+     int nicklistscroll;
 
      /* For irc info */
      IrcSession *session;
-     char name[HOSTLEN], *names;
-     NickStruct *nickhead;
-     int nnick;
+     Charset *charset;
+     char name[HOSTLEN];
+     /* NAMES reply until its end, see nick_load() */
+     struct { char *buf; int n, len, size; } names;
+     NickStruct *nickhead, *nickroot, **nicktab;
+     int nnick, nnicktab;
      char topic[BUFSIZE];
-     int act;
+     int act, actpos;
      unsigned int umask;
+     unsigned int hash;
+
+     ChanBuf *hnext;
+};
+
+/* Control socket client */
+typedef struct CtlClient CtlClient;
+struct CtlClient
+{
+     int fd;
+     Bool subscribed, dead, attach;
+     int fds[2];
+     char inbuf[BUFSIZE];
+     unsigned int inoffset;
+     /* Bounded output queue (ring) */
+     char *queue;
+     size_t qhead, qlen;
+     unsigned int dropped;
 
-     ChanBuf *next, *prev;
+     CtlClient *next, *prev;
 };
 
 /* Date struct */
@@ -254,6 +463,11 @@ typedef struct
      char autojoin[128][CHANLEN];
      int nautojoin;
      Bool ipv6;
+     char charset[CHARSETLEN];
+     char chancharset[32][CHANLEN + CHARSETLEN];
+     int nchancharset;
+     char highlight[32][HLLEN];
+     int nhighlight;
 } ServInfo;
 
 /* Config struct */
@@ -268,18 +482,55 @@ typedef struct
      int tcolor;
      int nickcolor;
      uint ignore;
+     unsigned int scrolllines;
+     size_t scrollsize;
+     Bool spill;
+     char spilldir[FILENAME_MAX + 1];
+     int histlines;
+     Bool histsave;
+     char histpath[FILENAME_MAX + 1];
+     int framerate;
+     char highlight[32][HLLEN];
+     int nhighlight;
+     /* "name:command", see input.c */
+     char alias[32][ALIASLEN];
+     int nalias;
      ServInfo *serv;
+     /* Control socket */
+     Bool ctl, ctldrop;
+     char ctlpath[FILENAME_MAX + 1];
+     size_t ctlqueue;
 } ConfStruct;
 
 /* Global struct */
 typedef struct
 {
      int ft, nbuf, running;
+     char *prog;
+     unsigned long lineseq;
      ConfStruct conf;
      IrcSession *selsession, *sessionhead;
-     ChanBuf *prevcb, *statuscb, *selcb, *cbhead;
+     ChanBuf *prevcb, *statuscb, *selcb;
+     /* Buffers by id (cb[0]: status), nbuf of maxbuf slots used */
+     ChanBuf **cb;
+     int maxbuf;
      Ui ui;
      DateStruct date;
+     /* Buffers with activity, most urgent first (see ui_buf_act); sorted
+      * is the same set in order, rebuilt for the status bar when dirty */
+     struct
+     {
+          ChanBuf **heap, **sorted;
+          int n, max;
+          Bool dirty;
+     } act;
+     /* Control socket */
+     struct
+     {
+          int sock, nsub;
+          unsigned long seq;
+          CtlClient *head;
+     } ctl;
 } HFTIrc;
 
 
@@ -293,16 +544,22 @@ void ui_init(void);
 void ui_init_color(void);
 int ui_color(int fg, int bg);
 void ui_update_statuswin(void);
+long ui_frame(Bool now);
 void ui_update_topicwin(void);
 void ui_update_infowin(void);
 void ui_update_nicklistwin(void);
-void ui_print(WINDOW *w, char *str, int n);
+void ui_print(WINDOW *w, char *str, unsigned long seq);
 void ui_print_buf(ChanBuf *cb, char *format, ...);
+void ui_print_msg(ChanBuf *cb, int kind, char rank, int color, const char *nick, const char *text);
+int ui_line_format(ScrollLine *l, char *buf, size_t size);
 void ui_draw_buf(ChanBuf *cb);
 ChanBuf *ui_buf_new(const char *name, IrcSession *session);
 void ui_buf_close(ChanBuf *cb);
 void ui_buf_set(int buf);
 void ui_buf_swap(int buf);
+void ui_buf_move(int buf);
+void ui_buf_act(ChanBuf *cb, int act);
+void ui_buf_urgent(void);
 void ui_scroll_up(ChanBuf *cb);
 void ui_scroll_down(ChanBuf *cb);
 void ui_nicklist_toggle(void);
@@ -311,6 +568,9 @@ void ui_refresh_curpos(void);
 void ui_set_color_theme(int col);
 void ui_get_input(void);
 void ui_screen_clear();
+Bool ui_attach(int infd, int outfd, const char *term);
+void ui_detach(void);
+void ui_resize(int lines, int cols);
 
 /* event.c */
 void dump_event(IrcSession *session, const char *event, const char *origin, const char **params, unsigned int count);
@@ -360,6 +620,7 @@ void irc_manage_event(IrcSession *session, int process_length);
 
 /* input.c */
 void input_manage(char *input);
+int input_complete(const char *prefix, const char **res, int max);
 void input_join(const char *input);
 void input_nick(const char *input);
 void input_quit(const char *input);
@@ -383,6 +644,7 @@ void input_away(const char *input);
 void input_ctcp(const char *input);
 void input_buffer(const char *input);
 void input_buffer_list(const char *input);
+void input_buffer_move(const char *input);
 void input_buffer_swap(const char *input);
 void input_buffer_prev(const char *input);
 void input_say(const char *input);
@@ -394,28 +656,107 @@ void input_invite(const char *input);
 void input_mode(const char *input);
 void input_clear(const char *input);
 void input_scrollclear(const char *input);
+void input_detach(const char *input);
+void input_upgrade(const char *input);
 
 /* util.c */
 void *xcalloc(size_t nmemb, size_t size);
 void *xmalloc(size_t nmemb, size_t size);
+void *xrealloc(void *ptr, size_t nmemb, size_t size);
 int xasprintf(char **strp, const char *fmt, ...);
 char *xstrdup(const char *str);
 void update_date(void);
+char *date_str(time_t t);
+int irc_strcasecmp(IrcSession *s, const char *a, const char *b);
+int irc_strncasecmp(IrcSession *s, const char *a, const char *b, size_t n);
+unsigned int irc_strhash(IrcSession *s, const char *str);
+void irc_casemap(IrcSession *s, const char *name);
+void buf_hash_add(ChanBuf *cb);
+void buf_hash_del(ChanBuf *cb);
 ChanBuf *find_buf(IrcSession *s, const char *str);
 ChanBuf *find_buf_wid(int id);
 void msg_sessbuf(IrcSession *session, char *str);
 int color_to_id(char *name);
 char *colorstr(int color, char *str, ...);
-char *nick_color(char *nick);
+int nick_colornum(const char *nick);
+char *nick_color(const char *nick, int col);
 int hftirc_waddwch(WINDOW *w, unsigned int mask, wchar_t wch);
+int utf8_decode(const char *s, int len, wchar_t *wc);
+int wc_width(wchar_t c);
+int ascii_len(const char *s, int len);
+Bool utf8_valid(const char *s, int len);
 wchar_t *complete_nick(ChanBuf *cb, unsigned int hits, wchar_t *start, int *beg);
 wchar_t *complete_input(ChanBuf *cb, unsigned int hits, wchar_t *start);
 
+/* control.c */
+void control_init(void);
+void control_close(void);
+void control_set_fds(fd_set *iset, fd_set *oset, int *maxfd);
+void control_process(fd_set *iset, fd_set *oset);
+void control_event(IrcSession *session, const char *kind, ...);
+int control_attach(void);
+void control_detach(void);
+int control_upgrade(void);
+void control_upgrade_cancel(void);
+void control_restore(int sock, int cfd, int infd, int outfd, const char *term);
+
+/* upgrade.c */
+void upgrade_exec(const char *path);
+void upgrade_restore(int fd);
+
+/* scroll.c */
+ScrollLine *scroll_add(Scroll *s, ScrollLine *r);
+ScrollLine *scroll_line(Scroll *s, unsigned int i);
+void scroll_free(Scroll *s);
+
+/* charset.c */
+Charset *charset_get(const char *name);
+Charset *charset_conf(const char *serv, const char *chan);
+int charset_in(IrcSession *s, char *buf, int len, size_t size);
+void charset_out(IrcSession *s, char *buf, size_t size);
+
+/* highlight.c */
+Bool highlight_match(IrcSession *s, const char *text);
+
+/* edit.c */
+void edit_set(const wchar_t *s);
+void edit_insert(wchar_t c);
+void edit_erase(int n);
+void edit_erase_word(void);
+void edit_move(int n);
+int edit_text(wchar_t *dst, int size);
+int edit_len(void);
+void edit_redraw(void);
+void edit_draw(void);
+
+/* history.c */
+void history_init(Bool load);
+void history_add(const char *line, Bool save);
+void history_flush(void);
+void history_close(void);
+int history_count(void);
+const char *history_get(int n);
+void history_search_start(void);
+const char *history_search_key(const char *key);
+const char *history_search_back(void);
+const char *history_search_next(void);
+const char *history_search_match(void);
+const char *history_search_query(void);
+
 /* nick.c  */
-void nick_attach(ChanBuf *cb, NickStruct *nick);
+NickStruct *nick_find(ChanBuf *cb, const char *nick);
+NickStruct *nick_nth(ChanBuf *cb, int n);
+NickStruct **nick_prefix(ChanBuf *cb, const char *prefix, int *n);
+NickStruct *nick_attach(ChanBuf *cb, const char *nick, char rang);
 void nick_detach(ChanBuf *cb, NickStruct *nick);
-NickStruct* nickstruct_set(char *nick);
-void nick_sort_abc(ChanBuf *cb);
+void nick_clear(ChanBuf *cb);
+void nick_load(ChanBuf *cb, const char *names, int n);
+void nick_set_rang(ChanBuf *cb, NickStruct *nick, char rang);
+void nick_reindex(ChanBuf *cb);
+IrcUser *user_find(IrcSession *s, const char *nick);
+void user_origin(IrcUser *u, const char *origin);
+void user_rename(IrcSession *s, IrcUser *u, const char *nick);
+void user_reindex(IrcSession *s);
 
 /* main.c */
 void signal_handler(int signal);
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Highlights.
+ *
+ * A message highlights if it holds, as a whole word, the nick of its
+ * session or a word of the highlight lists ([misc] and [server]); a
+ * "/regex/" entry is an extended regex, its match must be a whole word
+ * too.  Case is ignored.
+ *
+ * The nick and words of a session are compiled into an Aho-Corasick
+ * automaton (a DFA on the classes of the bytes they use), so a text is
+ * read once for all of them; the regexes are joined into one.  It is
+ * built again when the nick of the session changes.
+ */
+
+#include "hftirc.h"
+
+/* Nicks are words: "me" doesn't match in "me_" nor "meow" */
+#define HLWORD(c) (isalnum(c) || (c) >= 0x80 || strchr("_-[]\\`^{}|", (c)))
+
+/* Whole word: a word character must not go on out of the match */
+static Bool
+highlight_bounded(const unsigned char *t, int beg, int end)
+{
+     if(beg > 0 && HLWORD(t[beg - 1]) && HLWORD(t[beg]))
+          return False;
+
+     if(t[end] && HLWORD(t[end - 1]) && HLWORD(t[end]))
+          return False;
+
+     return True;
+}
+
+static ServInfo*
+highlight_serv(IrcSession *s)
+{
+     int i;
+
+     for(i = 0; s->name && i < hftirc.conf.nserv; ++i)
+          if(!strcmp(s->name, hftirc.conf.serv[i].name))
+               return &hftirc.conf.serv[i];
+
+     return NULL;
+}
+
+static void
+highlight_free(Highlight *hl)
+{
+     if(!hl)
+          return;
+
+     free(hl->next);
+     free(hl->out);
+     free(hl->link);
+
+     if(hl->hasre)
+          regfree(&hl->re);
+
+     free(hl);
+
+     return;
+}
+
+/* Add pattern p to the trie (next still holds -1 for "no edge") */
+static void
+highlight_add(Highlight *hl, const char *p, int *nstate)
+{
+     int st = 0, len = strlen(p);
+     int *e;
+
+     if(!len)
+          return;
+
+     for(; *p; ++p)
+     {
+          e = &hl->next[st * hl->nclass + hl->class[(unsigned char)*p]];
+
+          if(*e < 0)
+               *e = (*nstate)++;
+
+          st = *e;
+     }
+
+     hl->out[st] = len;
+
+     return;
+}
+
+static Highlight*
+highlight_build(IrcSession *s)
+{
+     Highlight *hl;
+     ServInfo *si = highlight_serv(s);
+     char *pats[65], re[BUFSIZE] = { 0 };
+     int *fail, *queue;
+     int i, j, c, n = 0, size = 1, nstate = 1, head = 0, tail = 0;
+     int u, v, *e;
+     unsigned char *p;
+
+     hl = xcalloc(1, sizeof(Highlight));
+     strncpy(hl->nick, s->nick, NICKLEN - 1);
+
+     /* Nick, then [misc] and [server] words; regexes apart */
+     pats[n++] = s->nick;
+
+     for(i = 0; i < hftirc.conf.nhighlight; ++i)
+          pats[n++] = hftirc.conf.highlight[i];
+
+     for(i = 0; si && i < si->nhighlight; ++i)
+          pats[n++] = si->highlight[i];
+
+     for(i = j = 0; i < n; ++i)
+     {
+          if(pats[i][0] == '/' && strlen(pats[i]) > 2 && pats[i][strlen(pats[i]) - 1] == '/')
+          {
+               snprintf(re + strlen(re), sizeof(re) - strlen(re), "%s(%.*s)",
+                         (strlen(re) ? "|" : ""), (int)strlen(pats[i]) - 2, pats[i] + 1);
+               continue;
+          }
+
+          pats[j++] = pats[i];
+     }
+
+     n = j;
+
+     if(strlen(re))
+     {
+          if(regcomp(&hl->re, re, REG_EXTENDED | REG_ICASE))
+               ui_print_buf(hftirc.statuscb, "[HFTIrc] Bad highlight regex: %s", re);
+          else
+               hl->hasre = True;
+     }
+
+     /* Byte classes, 0 for the bytes no pattern uses */
+     hl->nclass = 1;
+
+     for(i = 0; i < n; ++i)
+          for(p = (unsigned char*)pats[i]; *p; ++p, ++size)
+               if(!hl->class[tolower(*p)])
+                    hl->class[tolower(*p)] = hl->class[toupper(*p)] = hl->nclass++;
+
+     hl->next = xmalloc(size * hl->nclass, sizeof(int));
+     hl->out = xcalloc(size, sizeof(int));
+     hl->link = xcalloc(size, sizeof(int));
+     fail = xcalloc(size, sizeof(int));
+     queue = xmalloc(size, sizeof(int));
+
+     for(i = 0; i < size * hl->nclass; ++i)
+          hl->next[i] = -1;
+
+     for(i = 0; i < n; ++i)
+          highlight_add(hl, pats[i], &nstate);
+
+     /* Breadth first: failure links, and missing edges follow them */
+     for(c = 0; c < hl->nclass; ++c)
+          if(hl->next[c] < 0)
+               hl->next[c] = 0;
+          else
+               queue[tail++] = hl->next[c];
+
+     while(head < tail)
+     {
+          u = queue[head++];
+
+          for(c = 0; c < hl->nclass; ++c)
+          {
+               e = &hl->next[u * hl->nclass + c];
+
+               if(*e < 0)
+               {
+                    *e = hl->next[fail[u] * hl->nclass + c];
+                    continue;
+               }
+
+               v = *e;
+               fail[v] = hl->next[fail[u] * hl->nclass + c];
+               hl->link[v] = (hl->out[fail[v]] ? fail[v] : hl->link[fail[v]]);
+               queue[tail++] = v;
+          }
+     }
+
+     free(fail);
+     free(queue);
+
+     return hl;
+}
+
+/* Does text highlight in session s */
+Bool
+highlight_match(IrcSession *s, const char *text)
+{
+     Highlight *hl;
+     const unsigned char *t = (const unsigned char*)text;
+     regmatch_t m;
+     int i, o, st, off;
+
+     if(!s || !s->nick || !text)
+          return False;
+
+     /* Built again after a nick change */
+     if(!s->hl || strcmp(s->hl->nick, s->nick))
+     {
+          highlight_free(s->hl);
+          s->hl = highlight_build(s);
+     }
+
+     hl = s->hl;
+
+     for(i = st = 0; t[i]; ++i)
+     {
+          st = hl->next[st * hl->nclass + hl->class[t[i]]];
+
+          for(o = (hl->out[st] ? st : hl->link[st]); o; o = hl->link[o])
+               if(highlight_bounded(t, i + 1 - hl->out[o], i + 1))
+                    return True;
+     }
+
+     for(off = 0; hl->hasre && t[off]
+               && !regexec(&hl->re, text + off, 1, &m, (off ? REG_NOTBOL : 0)); ++off)
+     {
+          if(m.rm_eo > m.rm_so && highlight_bounded(t, off + m.rm_so, off + m.rm_eo))
+               return True;
+
+          off += m.rm_so;
+     }
+
+     return False;
+}
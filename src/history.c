@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Input history.
+ *
+ * The lines sent are kept in a ring of history_lines entries, each one
+ * allocated to its size; the oldest goes out first.  They are appended
+ * to history_file too, deferred: a line is queued when sent and the
+ * queue is written in one batch from the main loop (history_flush),
+ * once the command ran.  That write is a plain blocking one, it is
+ * only kept off the input path.  Commands that may carry a password
+ * are never written.
+ * At startup the file is mapped and its last lines fill the ring; it is
+ * rewritten with them only once it holds more dropped lines than kept.
+ *
+ * Ctrl-R searches backward with Knuth-Morris-Pratt: the failure table
+ * of the query grows with each key, and a longer query resumes from the
+ * current match, as a line the shorter query skipped can't hold it.
+ * The match of each query length is kept, backspace goes back to it.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "hftirc.h"
+
+static struct
+{
+     char **ent;
+     int size, first, n;
+     /* File and its append queue */
+     int fd;
+     char *queue;
+     size_t len, max;
+     /* Search: query, its failure table, match (index) per length */
+     char query[BUFSIZE];
+     int qlen, fail[BUFSIZE], match[BUFSIZE];
+} hist = { NULL, 0, 0, 0, -1 };
+
+/* Entry i, 0 is the oldest */
+#define HISTENT(i) (hist.ent[(hist.first + (i)) % hist.size])
+
+static void
+history_push(const char *line, size_t len)
+{
+     if(hist.n == hist.size)
+     {
+          free(hist.ent[hist.first]);
+          hist.first = (hist.first + 1) % hist.size;
+          --hist.n;
+     }
+
+     len = MIN(len, BUFSIZE - 1);
+
+     HISTENT(hist.n) = xmalloc(len + 1, 1);
+     memcpy(HISTENT(hist.n), line, len);
+     HISTENT(hist.n)[len] = '\0';
+     ++hist.n;
+
+     return;
+}
+
+/* Keep only the len bytes of beg in the file */
+static void
+history_compact(const char *beg, size_t len)
+{
+     char tmp[FILENAME_MAX + 8];
+     ssize_t w = 0;
+     int fd;
+
+     snprintf(tmp, sizeof(tmp), "%s.tmp", hftirc.conf.histpath);
+
+     if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+          return;
+
+     for(; len && (w = write(fd, beg, len)) > 0; beg += w, len -= w);
+
+     if(close(fd) || len || rename(tmp, hftirc.conf.histpath))
+          unlink(tmp);
+
+     return;
+}
+
+static void
+history_load(void)
+{
+     struct stat st;
+     char *map, *p, *e, *end;
+     int fd, n;
+
+     if((fd = open(hftirc.conf.histpath, O_RDONLY)) < 0)
+          return;
+
+     if(fstat(fd, &st) || st.st_size <= 0
+               || (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+     {
+          close(fd);
+          return;
+     }
+
+     end = map + st.st_size;
+
+     /* Back to the start of the last size lines */
+     for(p = end, n = 0; p > map && n < hist.size; ++n)
+          for(--p; p > map && p[-1] != '\n'; --p);
+
+     if(p - map > end - p)
+          history_compact(p, end - p);
+
+     for(; p < end; p = e + 1)
+     {
+          if(!(e = memchr(p, '\n', end - p)))
+               e = end;
+
+          if(e > p)
+               history_push(p, e - p);
+     }
+
+     munmap(map, st.st_size);
+     close(fd);
+
+     return;
+}
+
+/* Ring of history_lines, last lines of the file if load */
+void
+history_init(Bool load)
+{
+     hist.size = hftirc.conf.histlines;
+     hist.ent = xcalloc(hist.size, sizeof(char*));
+
+     if(!hftirc.conf.histsave)
+          return;
+
+     if(load)
+          history_load();
+
+     if((hist.fd = open(hftirc.conf.histpath, O_WRONLY | O_APPEND | O_CREAT, 0600)) >= 0)
+          fcntl(hist.fd, F_SETFD, FD_CLOEXEC);
+
+     return;
+}
+
+/* Commands that may carry a password (/msg NickServ identify, /raw
+ * PASS or OPER...): kept in the ring, never written to the file.
+ */
+static Bool
+history_secret(const char *line)
+{
+     static const char *word[] = { "nickserv", "identify", "pass", "oper" };
+     char low[BUFSIZE];
+     int i;
+
+     if(line[0] != '/')
+          return False;
+
+     for(i = 0; line[i] && i < BUFSIZE - 1; ++i)
+          low[i] = tolower((unsigned char)line[i]);
+
+     low[i] = '\0';
+
+     for(i = 0; i < (int)LEN(word); ++i)
+          if(strstr(low, word[i]))
+               return True;
+
+     return False;
+}
+
+/* New line, queued for the file if save */
+void
+history_add(const char *line, Bool save)
+{
+     size_t len = strlen(line);
+
+     if(!hist.size || !len || (hist.n && !strcmp(HISTENT(hist.n - 1), line)))
+          return;
+
+     history_push(line, len);
+
+     if(!save || hist.fd < 0 || history_secret(line))
+          return;
+
+     if(hist.len + len + 1 > hist.max)
+     {
+          hist.max = MAX(hist.max * 2, hist.len + len + 1);
+          hist.queue = xrealloc(hist.queue, hist.max, 1);
+     }
+
+     memcpy(hist.queue + hist.len, line, len);
+     hist.queue[hist.len + len] = '\n';
+     hist.len += len + 1;
+
+     return;
+}
+
+/* Write what is queued, deferred from history_add() to one batch */
+void
+history_flush(void)
+{
+     ssize_t w;
+
+     while(hist.len && hist.fd >= 0)
+     {
+          if((w = write(hist.fd, hist.queue, hist.len)) < 0)
+          {
+               if(errno == EINTR)
+                    continue;
+
+               /* Full disk or so: history isn't saved anymore */
+               close(hist.fd);
+               hist.fd = -1;
+               hist.len = 0;
+
+               break;
+          }
+
+          hist.len -= w;
+          memmove(hist.queue, hist.queue + w, hist.len);
+     }
+
+     return;
+}
+
+void
+history_close(void)
+{
+     history_flush();
+
+     if(hist.fd >= 0)
+          close(hist.fd);
+
+     while(hist.n)
+          free(HISTENT(--hist.n));
+
+     free(hist.ent);
+     free(hist.queue);
+
+     hist.ent = NULL;
+     hist.queue = NULL;
+     hist.fd = -1;
+     hist.size = hist.first = 0;
+     hist.len = hist.max = 0;
+
+     return;
+}
+
+int
+history_count(void)
+{
+     return hist.n;
+}
+
+/* Line n back, 1 is the last one */
+const char*
+history_get(int n)
+{
+     return ((n > 0 && n <= hist.n) ? HISTENT(hist.n - n) : NULL);
+}
+
+/* Newest entry from from (backward) that holds the query, -1 if none */
+static int
+history_find(int from)
+{
+     const char *s;
+     int k;
+
+     for(; from >= 0; --from)
+          for(s = HISTENT(from), k = 0; *s; ++s)
+          {
+               while(k && *s != hist.query[k])
+                    k = hist.fail[k - 1];
+
+               if(*s == hist.query[k] && ++k == hist.qlen)
+                    return from;
+          }
+
+     return -1;
+}
+
+const char*
+history_search_match(void)
+{
+     int i = hist.match[hist.qlen];
+
+     return ((hist.qlen && i >= 0 && i < hist.n) ? HISTENT(i) : NULL);
+}
+
+const char*
+history_search_query(void)
+{
+     return hist.query;
+}
+
+void
+history_search_start(void)
+{
+     hist.qlen = 0;
+     hist.query[0] = '\0';
+     hist.match[0] = hist.n;
+
+     return;
+}
+
+/* Bytes of a key added to the query */
+const char*
+history_search_key(const char *key)
+{
+     int k, from = hist.match[hist.qlen];
+
+     for(; *key && hist.qlen < BUFSIZE - 1; ++key)
+     {
+          k = 0;
+
+          if(hist.qlen)
+          {
+               for(k = hist.fail[hist.qlen - 1]; k && hist.query[k] != *key; k = hist.fail[k - 1]);
+
+               if(hist.query[k] == *key)
+                    ++k;
+          }
+
+          hist.fail[hist.qlen] = k;
+          hist.query[hist.qlen++] = *key;
+          hist.query[hist.qlen] = '\0';
+          hist.match[hist.qlen] = -1;
+     }
+
+     if(from >= 0)
+          hist.match[hist.qlen] = history_find(MIN(from, hist.n - 1));
+
+     return history_search_match();
+}
+
+/* Last character out of the query */
+const char*
+history_search_back(void)
+{
+     if(hist.qlen)
+     {
+          /* UTF-8 continuation bytes go with it */
+          while(--hist.qlen && (hist.query[hist.qlen] & 0xC0) == 0x80);
+          hist.query[hist.qlen] = '\0';
+     }
+
+     return history_search_match();
+}
+
+/* Older match of the same query */
+const char*
+history_search_next(void)
+{
+     int i;
+
+     if(hist.qlen && hist.match[hist.qlen] > 0
+               && (i = history_find(hist.match[hist.qlen] - 1)) >= 0)
+          hist.match[hist.qlen] = i;
+
+     return history_search_match();
+}
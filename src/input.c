@@ -19,29 +19,285 @@
 
 static int say_without_cmd = 0;
 
-void
-input_manage(char *input)
+/* Slash commands.
+ *
+ * The commands of input_struct (input.h) are put in a hash table with no
+ * collision: a seed is searched for once, at the first command, then a
+ * command is found with one hash and one strcmp.  The aliases of [misc]
+ * ("name:command") have their own hash table.  A word that is none of
+ * them runs the command or alias it is the prefix of, if there is only
+ * one (/buffer_l is /buffer_list, /nicklist is ambiguous).
+ */
+
+#define CMDHASH   (256)
+#define ALIASHASH (64)
+
+/* Command or alias */
+typedef struct
+{
+     const char *name;
+     const InputStruct *is;
+     /* Alias: command line, next index + 1 in its hash chain */
+     const char *cmd;
+     int next;
+} InputName;
+
+static struct
+{
+     Bool done;
+     unsigned int seed;
+     const InputStruct *tab[CMDHASH];
+     int alias[ALIASHASH];
+     /* Commands and aliases by name */
+     InputName *name;
+     int nname;
+} cmds;
+
+static unsigned int
+input_hash(const char *s, unsigned int seed)
+{
+     unsigned int h = 2166136261U ^ seed;
+
+     for(; *s; ++s)
+          h = (h ^ (unsigned char)*s) * 16777619U;
+
+     return h;
+}
+
+static const InputStruct*
+input_find(const char *cmd)
+{
+     const InputStruct *is = cmds.tab[input_hash(cmd, cmds.seed) & (CMDHASH - 1)];
+
+     return ((is && !strcmp(is->cmd, cmd)) ? is : NULL);
+}
+
+static InputName*
+input_alias(const char *name)
 {
      int i;
 
-     if(input[0] == '/')
+     for(i = cmds.alias[input_hash(name, 0) & (ALIASHASH - 1)]; i; i = cmds.name[i - 1].next)
+          if(!strcmp(cmds.name[i - 1].name, name))
+               return &cmds.name[i - 1];
+
+     return NULL;
+}
+
+static int
+input_name_cmp(const void *a, const void *b)
+{
+     return strcmp(((InputName*)a)->name, ((InputName*)b)->name);
+}
+
+static void
+input_index(void)
+{
+     char *p, *c;
+     int i, j, n = LEN(input_struct);
+
+     /* Seed with no collision among the commands */
+     for(cmds.seed = 0;; ++cmds.seed)
      {
-          /* Erase / */
-          ++input;
+          memset(cmds.tab, 0, sizeof(cmds.tab));
 
-          /* Erase spaces at the end */
-          for(; *(input + strlen(input) - 1) == ' '; *(input + strlen(input) - 1) = '\0');
+          for(i = 0; i < n; ++i)
+          {
+               j = input_hash(input_struct[i].cmd, cmds.seed) & (CMDHASH - 1);
 
-          for(i = 0; i < LEN(input_struct); ++i)
-               if(!strncmp(input, input_struct[i].cmd, strlen(input_struct[i].cmd)))
-                    input_struct[i].func(input + strlen(input_struct[i].cmd));
+               if(cmds.tab[j])
+                    break;
+
+               cmds.tab[j] = &input_struct[i];
+          }
+
+          if(i == n)
+               break;
      }
-     else
+
+     cmds.name = xcalloc(n + hftirc.conf.nalias, sizeof(InputName));
+
+     for(i = 0; i < n; ++i)
+     {
+          cmds.name[i].name = input_struct[i].cmd;
+          cmds.name[i].is = &input_struct[i];
+     }
+
+     /* Aliases, split in place; a command can't be hidden */
+     for(i = 0; i < hftirc.conf.nalias; ++i)
+     {
+          p = hftirc.conf.alias[i];
+
+          if(!(c = strchr(p, ':')) || c == p)
+          {
+               ui_print_buf(hftirc.statuscb, "[HFTIrc] Bad alias: %s", p);
+               continue;
+          }
+
+          for(*c++ = '\0'; *c == ' ' || *c == '/'; ++c);
+
+          for(j = 0; p[j]; ++j)
+               p[j] = tolower(p[j]);
+
+          for(j = LEN(input_struct); j < n && strcmp(cmds.name[j].name, p); ++j);
+
+          if(input_find(p) || j < n)
+          {
+               ui_print_buf(hftirc.statuscb, "[HFTIrc] Alias %s: already a command", p);
+               continue;
+          }
+
+          cmds.name[n].name = p;
+          cmds.name[n++].cmd = c;
+     }
+
+     qsort(cmds.name, n, sizeof(InputName), input_name_cmp);
+     cmds.nname = n;
+
+     for(i = 0; i < n; ++i)
+          if(!cmds.name[i].is)
+          {
+               j = input_hash(cmds.name[i].name, 0) & (ALIASHASH - 1);
+               cmds.name[i].next = cmds.alias[j];
+               cmds.alias[j] = i + 1;
+          }
+
+     cmds.done = True;
+
+     return;
+}
+
+/* First name not before prefix (len bytes), binary search */
+static int
+input_lower(const char *prefix, int len)
+{
+     int lo = 0, hi = cmds.nname, mid;
+
+     while(lo < hi)
+     {
+          mid = (lo + hi) / 2;
+
+          if(strncmp(cmds.name[mid].name, prefix, len) < 0)
+               lo = mid + 1;
+          else
+               hi = mid;
+     }
+
+     return lo;
+}
+
+/* Commands and aliases starting with prefix, in order (max at most) */
+int
+input_complete(const char *prefix, const char **res, int max)
+{
+     int i, n, len = strlen(prefix);
+
+     if(!cmds.done)
+          input_index();
+
+     for(i = input_lower(prefix, len), n = 0;
+               i < cmds.nname && n < max && !strncmp(cmds.name[i].name, prefix, len); ++i)
+          res[n++] = cmds.name[i].name;
+
+     return n;
+}
+
+/* Run command line input (without /); the command of an alias can't
+ * be another alias.
+ */
+static void
+input_run(const char *input, Bool alias)
+{
+     char cmd[ALIASLEN], buf[BUFSIZE], list[BUFSIZE] = { 0 };
+     const InputStruct *is;
+     InputName *in = NULL;
+     int i, j, n;
+
+     for(i = 0; input[i] && input[i] != ' '; ++i)
+          if(i < ALIASLEN - 1)
+               cmd[i] = tolower(input[i]);
+
+     cmd[MIN(i, ALIASLEN - 1)] = '\0';
+
+     if(!cmd[0])
+          return;
+
+     /* Exact command, then alias */
+     if((is = input_find(cmd)))
+     {
+          is->func(input + i);
+          return;
+     }
+
+     if(!alias || !(in = input_alias(cmd)))
+     {
+          /* Prefix of a single one */
+          for(j = input_lower(cmd, strlen(cmd)), n = 0;
+                    j < cmds.nname && !strncmp(cmds.name[j].name, cmd, strlen(cmd)); ++j)
+               if(alias || cmds.name[j].is)
+               {
+                    in = &cmds.name[j];
+                    ++n;
+                    snprintf(list + strlen(list), sizeof(list) - strlen(list), " %s", in->name);
+               }
+
+          if(n != 1)
+          {
+               if(n)
+                    ui_print_buf(hftirc.statuscb, "Error: Ambiguous command /%s:%s", cmd, list);
+               else
+                    ui_print_buf(hftirc.statuscb, "Error: Unknown command /%s", cmd);
+
+               return;
+          }
+
+          if(in->is)
+          {
+               in->is->func(input + i);
+               return;
+          }
+     }
+
+     /* Alias: its command line, then the arguments */
+     snprintf(buf, sizeof(buf), "%s%s", in->cmd, input + i);
+     input_run(buf, False);
+
+     return;
+}
+
+void
+input_manage(char *input)
+{
+     int len;
+
+     if(input[0] != '/')
+     {
+          say_without_cmd = 1;
+          input_say(input);
+
+          return;
+     }
+
+     /* Erase / */
+     ++input;
+
+     /* //text says /text */
+     if(input[0] == '/')
      {
           say_without_cmd = 1;
           input_say(input);
+
+          return;
      }
 
+     /* Erase spaces at the end */
+     for(len = strlen(input); len && input[len - 1] == ' '; input[--len] = '\0');
+
+     if(!cmds.done)
+          input_index();
+
+     input_run(input, True);
+
      return;
 }
 
@@ -115,8 +371,14 @@ input_help(const char *input)
 
      ui_print_buf(0, "[Hftirc] *** %cCommands list%c:", B, B);
 
-     for(i = 0; i < LEN(input_struct); ++i)
-          ui_print_buf(0, "[Hftirc] - %s", input_struct[i].cmd);
+     if(!cmds.done)
+          input_index();
+
+     for(i = 0; i < cmds.nname; ++i)
+          if(cmds.name[i].is)
+               ui_print_buf(0, "[Hftirc] - %s", cmds.name[i].name);
+          else
+               ui_print_buf(0, "[Hftirc] - %s (/%s)", cmds.name[i].name, cmds.name[i].cmd);
 
      return;
 }
@@ -166,7 +428,7 @@ input_me(const char *input)
                     hftirc.selcb->name, input))
           WARN("Error", "Can't send action message");
      else
-          ui_print_buf(hftirc.selcb, " %c* %s%c %s", B, hftirc.selsession->nick, B, input);
+          ui_print_msg(hftirc.selcb, LineAction, 0, 0, hftirc.selsession->nick, input);
 
      return;
 }
@@ -206,7 +468,7 @@ input_msg(const char *input)
           if(irc_send_raw(hftirc.selsession, "PRIVMSG %s :%s", nick, msg))
                WARN("Error", "Can't send MSG");
           else if((cb = find_buf(hftirc.selsession, nick)))
-                ui_print_buf(cb, "<%s> %s", hftirc.selsession->nick, msg);
+                ui_print_msg(cb, LinePriv, 0, 0, hftirc.selsession->nick, msg);
      }
 
      return;
@@ -278,23 +540,20 @@ void
 input_query(const char *input)
 {
      ChanBuf *cb;
-     NickStruct *ns;
 
      DSINPUT(input);
      NOSERVRET();
 
      if(strlen(input) > 0)
      {
-          for(cb = hftirc.cbhead; cb; cb = cb->next)
-               if(!strcmp(cb->name, input) && cb->session == hftirc.selsession)
-               {
-                    ui_buf_set(cb->id);
-                    return;
-               }
+          if((cb = find_buf(hftirc.selsession, input)) != hftirc.statuscb)
+          {
+               ui_buf_set(cb->id);
+               return;
+          }
 
           cb = ui_buf_new(input, hftirc.selsession);
-          ns = nickstruct_set((char *)input);
-          nick_attach(cb, ns);
+          nick_attach(cb, input, '\0');
           ui_buf_set(cb->id);
           ui_print_buf(cb, "  *** Query with %s", input);
      }
@@ -369,7 +628,10 @@ input_serv(const char *input)
           hftirc.selsession
                = (!hftirc.selsession->next ? hftirc.sessionhead : hftirc.selsession->next);
 
-     refresh();
+     hftirc.ui.statusmod = True;
+
+     if(hftirc.ui.attached)
+          refresh();
 
      return;
 }
@@ -377,6 +639,9 @@ input_serv(const char *input)
 void
 input_redraw(const char *input)
 {
+     if(!hftirc.ui.attached)
+          return;
+
      endwin();
      ui_init();
      ui_buf_set(hftirc.selcb->id);
@@ -408,6 +673,7 @@ input_connect(const char *input)
                ui_print_buf(hftirc.statuscb, "Error: Can't connect to %s", input);
 
           hftirc.selsession = is;
+          hftirc.ui.statusmod = True;
      }
      else
           WARN("Error", "Usage: /connect <adress>  or  /server <adress>");
@@ -526,10 +792,11 @@ void
 input_buffer_list(const char *input)
 {
      ChanBuf *cb;
+     int i;
 
      ui_print_buf(hftirc.statuscb, "[Hftirc] %cBuffers list%c:", B, B);
 
-     for(cb = hftirc.cbhead; cb; cb = cb->next)
+     for(i = 0; i < hftirc.nbuf && (cb = hftirc.cb[i]); ++i)
           ui_print_buf(hftirc.statuscb, "[Hftirc] - %d: %s", cb->id, cb->name);
 
      return;
@@ -547,21 +814,32 @@ input_buffer_prev(const char *input)
 }
 
 
+void
+input_buffer_move(const char *input)
+{
+     int i;
+
+     DSINPUT(input);
+
+     if(strlen(input) > 0 && (i = atoi(input)))
+          ui_buf_move(i);
+     else
+          WARN("Error", "Usage: /buffer_move <num>");
+
+     return;
+}
+
 void
 input_buffer_swap(const char *input)
 {
-    int i;
+     int i;
 
-    if(strlen(input) > 0)
-    {
-        if((i = atoi(input)))
-        {
-            ui_buf_swap(i);
-            return;
-        }
-     }
+     DSINPUT(input);
+
+     if(strlen(input) > 0 && (i = atoi(input)))
+          ui_buf_swap(i);
      else
-        WARN("Error", "Usage: /buffer_swap <num>");
+          WARN("Error", "Usage: /buffer_swap <num>");
 
      return;
 }
@@ -583,8 +861,7 @@ input_say(const char *input)
                WARN("Error", "Can't send message");
           else
                /* Write what we said on buffer, with cyan color */
-               ui_print_buf(hftirc.selcb, "%s", colorstr(Cyan, "<%s> %s",
-                              hftirc.selsession->nick, input));
+               ui_print_msg(hftirc.selcb, LineSelf, 0, 0, hftirc.selsession->nick, input);
      }
      else
           WARN("Error", "Usage: /say <message>");
@@ -718,13 +995,35 @@ input_clear(const char *input)
 void
 input_scrollclear(const char *input)
 {
-     if(!hftirc.selcb->scrollpos)
+     scroll_free(&hftirc.selcb->scroll);
+     hftirc.selcb->scrollpos = 0;
+
+     ui_screen_clear();
+
+     return;
+}
+
+
+void
+input_detach(const char *input)
+{
+     if(hftirc.ctl.sock < 0)
      {
-          ui_screen_clear();
+          WARN("Error", "Can't detach without control socket, see [control] in configuration");
+          return;
      }
 
-     hftirc.selcb->bufpos = 0;
+     ui_detach();
 
      return;
 }
 
+void
+input_upgrade(const char *input)
+{
+     DSINPUT(input);
+
+     upgrade_exec(input);
+
+     return;
+}
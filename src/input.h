@@ -21,6 +21,7 @@ static const InputStruct input_struct[] =
      { "away",            input_away },
      { "buffer",          input_buffer },
      { "buffer_list",     input_buffer_list },
+     { "buffer_move",     input_buffer_move },
      { "buffer_prev",     input_buffer_prev},
      { "buffer_swap",     input_buffer_swap },
      { "clear",           input_clear },
@@ -28,6 +29,7 @@ static const InputStruct input_struct[] =
      { "color_theme",     input_color_theme },
      { "connect",         input_connect },
      { "ctcp",            input_ctcp },
+     { "detach",          input_detach },
      { "disconnect",      input_disconnect },
      { "help",            input_help },
      { "invite",          input_invite },
@@ -52,6 +54,7 @@ static const InputStruct input_struct[] =
      { "server",          input_connect },
      { "topic",           input_topic },
      { "umode",           input_umode },
+     { "upgrade",         input_upgrade },
      { "whois",           input_whois },
      { "/",               input_say },
 };
@@ -54,6 +54,7 @@ irc_connect(IrcSession *s,
      s->nick   = strdup(nick);
      s->server = strdup(server);
      s->name   = strdup(servername);
+     s->charset = charset_conf(servername, NULL);
 
      if(!(hp = gethostbyname(server)))
           return 1;
@@ -77,6 +78,7 @@ irc_connect(IrcSession *s,
     irc_send_raw(s, "USER %s localhost %s :%s", username, server, realname);
 
     s->connected = 1;
+    hftirc.ui.statusmod = True;
 
     return 0;
 }
@@ -89,6 +91,7 @@ irc_disconnect(IrcSession *s)
 
      s->sock = -1;
      s->connected = 0;
+     hftirc.ui.statusmod = True;
 
      /* Signal disconnection on each channel */
      msg_sessbuf(s, "  *** Server disconnected by client");
@@ -156,6 +159,8 @@ irc_send_raw(IrcSession *s, const char *format, ...)
      if(!s->sock)
           return 1;
 
+     charset_out(s, buf, sizeof(buf) - 2);
+
      strcat(buf, "\r\n");
 
      send(s->sock, buf, strlen(buf), 0);
@@ -219,8 +224,8 @@ void
 irc_manage_event(IrcSession *session, int process_length)
 {
      char buf[BUFSIZE], ctcp_buf[128];
-     const char command[BUFSIZE] = { 0 };
-     const char prefix[BUFSIZE] =  { 0 };
+     char command[BUFSIZE] = { 0 };
+     char prefix[BUFSIZE] =  { 0 };
      const char *params[11];
      int code = 0, paramindex = 0;
      unsigned int msglen;
@@ -231,6 +236,9 @@ irc_manage_event(IrcSession *session, int process_length)
      memcpy(buf, session->inbuf, process_length);
      buf[process_length] = '\0';
 
+     /* To UTF-8 */
+     charset_in(session, buf, process_length, sizeof(buf));
+
      memset((char *)params, 0, sizeof(params));
 
      /* Parse socket */
@@ -287,6 +295,7 @@ irc_manage_event(IrcSession *session, int process_length)
                {
                     free(session->nick);
                     session->nick = strdup(params[0]);
+                    hftirc.ui.statusmod = True;
                }
 
                event_nick(session, command, prefix, params, paramindex);
@@ -392,6 +401,7 @@ irc_init(void)
           is = irc_session();
 
           hftirc.selsession = is;
+          hftirc.ui.statusmod = True;
 
           if(irc_connect(is,
                          hftirc.conf.serv[i].adress,
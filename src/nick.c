@@ -18,99 +18,735 @@
 #include "hftirc.h"
 #include "input.h"
 
-static void nick_swap(NickStruct *x, NickStruct *y);
+/* Members of a channel.
+ *
+ * Each NickStruct of cb is in three places:
+ *  - cb->nicktab, a hash table on the casefolded nick, for nick_find();
+ *  - cb->nickroot, a treap ordered by (rank, casefolded nick) where each
+ *    node knows the size of its subtree, so nick_nth() is O(log n);
+ *  - cb->nickhead, a list in the same order, for the walks.
+ * Joins, parts and mode or nick changes are O(log n), nothing is sorted
+ * again.
+ * A NAMES reply is kept in cb->names until its end, then nick_load()
+ * sorts it once and builds the indexes from it.
+ *
+ * A nick is kept once per session, in an IrcUser of s->usertab (hash on
+ * the casefolded nick) that also has its user@host and nick color.  The
+ * NickStruct of the user on each channel point to it and are listed in
+ * u->chans, refs counts them: the user goes with the last one.  So a
+ * nick change or a quit only touches the channels of the user.
+ */
+
+#define NSIZE(t) ((t) ? (t)->size : 0)
+
+/* @ then % then + then the others */
+static int
+nick_rank(char rang)
+{
+     switch(rang)
+     {
+          case '@': return 0;
+          case '%': return 1;
+          case '+': return 2;
+          default:  return 3;
+     }
+}
+
+static int
+nick_cmp(ChanBuf *cb, NickStruct *a, NickStruct *b)
+{
+     int r;
+
+     if((r = nick_rank(a->rang) - nick_rank(b->rang)))
+          return r;
+
+     if((r = irc_strcasecmp(cb->session, a->nick, b->nick)))
+          return r;
+
+     return strcmp(a->nick, b->nick);
+}
+
+static NickStruct*
+nick_rotate_right(NickStruct *t)
+{
+     NickStruct *l = t->left;
+
+     t->left = l->right;
+     l->right = t;
+     l->size = t->size;
+     t->size = NSIZE(t->left) + NSIZE(t->right) + 1;
 
+     return l;
+}
+
+static NickStruct*
+nick_rotate_left(NickStruct *t)
+{
+     NickStruct *r = t->right;
+
+     t->right = r->left;
+     r->left = t;
+     r->size = t->size;
+     t->size = NSIZE(t->left) + NSIZE(t->right) + 1;
+
+     return r;
+}
+
+/* Insert ns under t; *pred gets the node ns comes after, if any */
+static NickStruct*
+nick_tree_insert(ChanBuf *cb, NickStruct *t, NickStruct *ns, NickStruct **pred)
+{
+     if(!t)
+          return ns;
+
+     ++t->size;
+
+     if(nick_cmp(cb, ns, t) < 0)
+     {
+          t->left = nick_tree_insert(cb, t->left, ns, pred);
+
+          if(t->left->prio > t->prio)
+               t = nick_rotate_right(t);
+     }
+     else
+     {
+          *pred = t;
+          t->right = nick_tree_insert(cb, t->right, ns, pred);
+
+          if(t->right->prio > t->prio)
+               t = nick_rotate_left(t);
+     }
+
+     return t;
+}
+
+static NickStruct*
+nick_tree_merge(NickStruct *a, NickStruct *b)
+{
+     if(!a || !b)
+          return (a ? a : b);
+
+     if(a->prio > b->prio)
+     {
+          a->size += b->size;
+          a->right = nick_tree_merge(a->right, b);
+
+          return a;
+     }
+
+     b->size += a->size;
+     b->left = nick_tree_merge(a, b->left);
+
+     return b;
+}
+
+static NickStruct*
+nick_tree_remove(ChanBuf *cb, NickStruct *t, NickStruct *ns)
+{
+     if(!t)
+          return NULL;
+
+     if(t == ns)
+          return nick_tree_merge(t->left, t->right);
+
+     --t->size;
+
+     if(nick_cmp(cb, ns, t) < 0)
+          t->left = nick_tree_remove(cb, t->left, ns);
+     else
+          t->right = nick_tree_remove(cb, t->right, ns);
+
+     return t;
+}
+
+/* Ordered index and list */
 static void
-nick_swap(NickStruct *x, NickStruct *y)
+nick_link(ChanBuf *cb, NickStruct *ns)
 {
-     NickStruct t = *x;
+     NickStruct *pred = NULL;
 
-     strcpy(x->nick, y->nick);
-     x->rang = y->rang;
+     ns->left = ns->right = NULL;
+     ns->size = 1;
+     cb->nickroot = nick_tree_insert(cb, cb->nickroot, ns, &pred);
 
-     strcpy(y->nick, t.nick);
-     y->rang = t.rang;
+     ns->prev = pred;
+     ns->next = (pred ? pred->next : cb->nickhead);
+
+     if(ns->next)
+          ns->next->prev = ns;
+
+     if(pred)
+          pred->next = ns;
+     else
+          cb->nickhead = ns;
 
      return;
 }
 
+static void
+nick_unlink(ChanBuf *cb, NickStruct *ns)
+{
+     cb->nickroot = nick_tree_remove(cb, cb->nickroot, ns);
+
+     if(ns->prev)
+          ns->prev->next = ns->next;
+     else
+          cb->nickhead = ns->next;
+
+     if(ns->next)
+          ns->next->prev = ns->prev;
+
+     ns->next = ns->prev = NULL;
+
+     return;
+}
+
+/* Hash index */
+static void
+nick_hash_add(ChanBuf *cb, NickStruct *ns)
+{
+     NickStruct *n, **tab;
+     int i;
+
+     if(cb->nnick >= cb->nnicktab)
+     {
+          i = (cb->nnicktab ? cb->nnicktab * 2 : 16);
+          tab = xcalloc(i, sizeof(NickStruct*));
+
+          for(n = cb->nickhead; n; n = n->next)
+          {
+               n->hnext = tab[n->user->hash & (i - 1)];
+               tab[n->user->hash & (i - 1)] = n;
+          }
+
+          free(cb->nicktab);
+          cb->nicktab = tab;
+          cb->nnicktab = i;
+     }
+
+     ns->hnext = cb->nicktab[ns->user->hash & (cb->nnicktab - 1)];
+     cb->nicktab[ns->user->hash & (cb->nnicktab - 1)] = ns;
+
+     return;
+}
+
+static void
+nick_hash_del(ChanBuf *cb, NickStruct *ns)
+{
+     NickStruct **p;
+
+     for(p = &cb->nicktab[ns->user->hash & (cb->nnicktab - 1)]; *p; p = &(*p)->hnext)
+          if(*p == ns)
+          {
+               *p = ns->hnext;
+               break;
+          }
+
+     return;
+}
+
+/* Users of a session */
+static void
+user_hash_add(IrcSession *s, IrcUser *u)
+{
+     IrcUser *n, *next, **tab;
+     int i, j;
+
+     if(s->nuser >= s->nusertab)
+     {
+          j = (s->nusertab ? s->nusertab * 2 : 64);
+          tab = xcalloc(j, sizeof(IrcUser*));
+
+          for(i = 0; i < s->nusertab; ++i)
+               for(n = s->usertab[i]; n; n = next)
+               {
+                    next = n->hnext;
+                    n->hnext = tab[n->hash & (j - 1)];
+                    tab[n->hash & (j - 1)] = n;
+               }
+
+          free(s->usertab);
+          s->usertab = tab;
+          s->nusertab = j;
+     }
+
+     u->hash = irc_strhash(s, u->nick);
+     u->hnext = s->usertab[u->hash & (s->nusertab - 1)];
+     s->usertab[u->hash & (s->nusertab - 1)] = u;
+     ++s->nuser;
+
+     return;
+}
+
+static void
+user_hash_del(IrcSession *s, IrcUser *u)
+{
+     IrcUser **p;
+
+     for(p = &s->usertab[u->hash & (s->nusertab - 1)]; *p; p = &(*p)->hnext)
+          if(*p == u)
+          {
+               *p = u->hnext;
+               --s->nuser;
+               break;
+          }
+
+     return;
+}
+
+IrcUser*
+user_find(IrcSession *s, const char *nick)
+{
+     IrcUser *u;
+     unsigned int h;
+
+     if(!s || !nick || !s->nusertab)
+          return NULL;
+
+     h = irc_strhash(s, nick);
+
+     for(u = s->usertab[h & (s->nusertab - 1)]; u; u = u->hnext)
+          if(u->hash == h && !irc_strcasecmp(s, nick, u->nick))
+               return u;
+
+     return NULL;
+}
+
+/* Interned user of nick, made if needed */
+static IrcUser*
+user_get(IrcSession *s, const char *nick)
+{
+     IrcUser *u;
+
+     if((u = user_find(s, nick)))
+          return u;
+
+     u = xcalloc(1, sizeof(IrcUser));
+     strncpy(u->nick, nick, NICKLEN - 1);
+     u->color = nick_colornum(u->nick);
+     user_hash_add(s, u);
+
+     return u;
+}
+
+/* Drop a reference, the user goes with the last one */
+static void
+user_put(IrcSession *s, IrcUser *u)
+{
+     if(--u->refs > 0)
+          return;
+
+     user_hash_del(s, u);
+     free(u->user);
+     free(u->host);
+     free(u);
+
+     return;
+}
+
+/* user@host of u, from an origin "nick!user@host" */
+void
+user_origin(IrcUser *u, const char *origin)
+{
+     const char *p, *h;
+
+     if(!u || !origin || !(p = strchr(origin, '!')) || !(h = strchr(p, '@')))
+          return;
+
+     if(u->host && !strcmp(u->host, h + 1)
+               && !strncmp(u->user, p + 1, h - p - 1) && !u->user[h - p - 1])
+          return;
+
+     free(u->user);
+     free(u->host);
+
+     u->user = xcalloc(h - p, 1);
+     memcpy(u->user, p + 1, h - p - 1);
+     u->host = strdup(h + 1);
 
-/* Sort alphabetically nick list */
+     return;
+}
+
+/* Nick change: the user moves in the order of each of its channels */
 void
-nick_sort_abc(ChanBuf *cb)
+user_rename(IrcSession *s, IrcUser *u, const char *nick)
 {
-     int swap = 1;
      NickStruct *ns;
 
-     if(!cb || !(cb->umask & UNickSortMask))
+     for(ns = u->chans; ns; ns = ns->unext)
+     {
+          nick_hash_del(ns->cb, ns);
+          nick_unlink(ns->cb, ns);
+     }
+
+     user_hash_del(s, u);
+
+     memset(u->nick, 0, NICKLEN);
+     strncpy(u->nick, nick, NICKLEN - 1);
+     u->color = nick_colornum(u->nick);
+
+     user_hash_add(s, u);
+
+     for(ns = u->chans; ns; ns = ns->unext)
+     {
+          nick_hash_add(ns->cb, ns);
+          nick_link(ns->cb, ns);
+          ns->cb->umask |= UNickListMask;
+     }
+
+     return;
+}
+
+/* Hash again after a casemapping change, before nick_reindex() */
+void
+user_reindex(IrcSession *s)
+{
+     IrcUser *u, *next, **tab;
+     int i;
+
+     if(!s->nusertab)
           return;
 
-     /* Count nicks for nnick */
-     for(cb->nnick = 0, ns = cb->nickhead;
-               ns;
-               ns = ns->next, ++cb->nnick);
+     tab = xcalloc(s->nusertab, sizeof(IrcUser*));
+
+     for(i = 0; i < s->nusertab; ++i)
+          for(u = s->usertab[i]; u; u = next)
+          {
+               next = u->hnext;
+               u->hash = irc_strhash(s, u->nick);
+               u->hnext = tab[u->hash & (s->nusertab - 1)];
+               tab[u->hash & (s->nusertab - 1)] = u;
+          }
+
+     free(s->usertab);
+     s->usertab = tab;
+
+     return;
+}
+
+NickStruct*
+nick_find(ChanBuf *cb, const char *nick)
+{
+     NickStruct *ns;
+     unsigned int h;
+
+     if(!cb || !nick || !cb->nnicktab)
+          return NULL;
+
+     h = irc_strhash(cb->session, nick);
+
+     for(ns = cb->nicktab[h & (cb->nnicktab - 1)]; ns; ns = ns->hnext)
+          if(ns->user->hash == h && !irc_strcasecmp(cb->session, nick, ns->nick))
+               return ns;
+
+     return NULL;
+}
+
+/* n-th nick in nicklist order, NULL past the end */
+NickStruct*
+nick_nth(ChanBuf *cb, int n)
+{
+     NickStruct *t = cb->nickroot;
 
-     /* Alphabetical bubble sort */
-     while(swap)
+     while(t && n != NSIZE(t->left))
      {
-          swap = 0;
-          for(ns = cb->nickhead; ns && ns->next; ns = ns->next)
-               if(strcasecmp(ns->nick, ns->next->nick) > 0)
+          if(n < NSIZE(t->left))
+               t = t->left;
+          else
+          {
+               n -= NSIZE(t->left) + 1;
+               t = t->right;
+          }
+     }
+
+     return t;
+}
+
+/* New member of cb, in the channels of its user but not indexed yet */
+static NickStruct*
+nick_new(ChanBuf *cb, const char *nick, char rang)
+{
+     NickStruct *ns;
+     IrcUser *u;
+
+     u = user_get(cb->session, nick);
+
+     ns = xcalloc(1, sizeof(NickStruct));
+     ns->user = u;
+     ns->nick = u->nick;
+     ns->rang = rang;
+     ns->cb = cb;
+     ns->prio = rand();
+
+     if((ns->unext = u->chans))
+          u->chans->uprev = ns;
+
+     u->chans = ns;
+     ++u->refs;
+
+     return ns;
+}
+
+/* Members whose nick starts with prefix, in nicklist order: *n of them
+ * in an array to free (NULL if none).  A lower bound in the order of
+ * each rank then a walk, O(log n) plus the matches.
+ */
+NickStruct**
+nick_prefix(ChanBuf *cb, const char *prefix, int *n)
+{
+     NickStruct *t, *ns, **res = NULL;
+     int r, c, size = 0, len = strlen(prefix);
+
+     *n = 0;
+
+     for(r = 0; cb && r < 4; ++r)
+     {
+          for(ns = NULL, t = cb->nickroot; t;)
+          {
+               if(!(c = nick_rank(t->rang) - r))
+                    c = irc_strcasecmp(cb->session, t->nick, prefix);
+
+               if(c >= 0)
                {
-                    swap = 1;
-                    nick_swap(ns, ns->next);
+                    ns = t;
+                    t = t->left;
                }
+               else
+                    t = t->right;
+          }
+
+          for(; ns && nick_rank(ns->rang) == r
+                    && !irc_strncasecmp(cb->session, ns->nick, prefix, len); ns = ns->next)
+          {
+               if(*n >= size)
+                    res = xrealloc(res, (size = (size ? size * 2 : 16)), sizeof(NickStruct*));
+
+               res[(*n)++] = ns;
+          }
      }
 
-    cb->umask &= ~UNickSortMask;
+     return res;
+}
+
+/* Add nick to cb (nothing if it's already there), with its user */
+NickStruct*
+nick_attach(ChanBuf *cb, const char *nick, char rang)
+{
+     NickStruct *ns;
 
-    return;
+     /* The status buffer has no members */
+     if(!cb || !cb->session || cb == hftirc.statuscb)
+          return NULL;
+
+     if((ns = nick_find(cb, nick)))
+          return ns;
+
+     ns = nick_new(cb, nick, rang);
+
+     nick_hash_add(cb, ns);
+     nick_link(cb, ns);
+     ++cb->nnick;
+
+     cb->umask |= UNickListMask;
+
+     return ns;
 }
 
+/* Out of the channels list of its user */
+static void
+nick_free(ChanBuf *cb, NickStruct *ns)
+{
+     if(ns->uprev)
+          ns->uprev->unext = ns->unext;
+     else
+          ns->user->chans = ns->unext;
+
+     if(ns->unext)
+          ns->unext->uprev = ns->uprev;
+
+     user_put(cb->session, ns->user);
+     free(ns);
+
+     return;
+}
+
+/* Remove nick from cb and free it */
 void
-nick_attach(ChanBuf *cb, NickStruct *nick)
+nick_detach(ChanBuf *cb, NickStruct *nick)
 {
-     if(!cb)
+     if(!cb || !nick)
           return;
 
-     HFTLIST_ATTACH(cb->nickhead, nick);
+     nick_hash_del(cb, nick);
+     nick_unlink(cb, nick);
+     --cb->nnick;
+     nick_free(cb, nick);
 
-     cb->umask |= (UNickSortMask | UNickListMask);
+     cb->umask |= UNickListMask;
 
      return;
 }
 
+/* Remove every nick of cb */
 void
-nick_detach(ChanBuf *cb, NickStruct *nick)
+nick_clear(ChanBuf *cb)
 {
+     NickStruct *ns, *next;
+
      if(!cb)
           return;
 
-     HFTLIST_DETACH(cb->nickhead, NickStruct, nick);
+     for(ns = cb->nickhead; ns; ns = next)
+     {
+          next = ns->next;
+          nick_free(cb, ns);
+     }
+
+     cb->nickhead = cb->nickroot = NULL;
+     cb->nnick = 0;
 
-     cb->umask |= (UNickSortMask | UNickListMask);
+     if(cb->nnicktab)
+          memset(cb->nicktab, 0, cb->nnicktab * sizeof(NickStruct*));
+
+     cb->umask |= UNickListMask;
 
      return;
 }
 
-NickStruct*
-nickstruct_set(char *nick)
+static ChanBuf *nick_sortcb = NULL;
+
+static int
+nick_qcmp(const void *a, const void *b)
+{
+     return nick_cmp(nick_sortcb, *(NickStruct**)a, *(NickStruct**)b);
+}
+
+/* Balanced treap of the sorted a[lo..hi[: priorities go down with the
+ * depth, the nicks added later mostly end up under it.
+ */
+static NickStruct*
+nick_tree_build(NickStruct **a, int lo, int hi, int depth)
 {
-     NickStruct *ret;
+     NickStruct *t;
+     int mid = lo + (hi - lo) / 2;
 
-     ret = calloc(1, sizeof(NickStruct));
+     if(lo >= hi)
+          return NULL;
 
-     memset(ret->nick, 0, NICKLEN);
-     ret->rang = '\0';
+     t = a[mid];
+     t->prio = RAND_MAX - depth;
+     t->size = hi - lo;
+     t->left = nick_tree_build(a, lo, mid, depth + 1);
+     t->right = nick_tree_build(a, mid + 1, hi, depth + 1);
+
+     return t;
+}
+
+/* Members of cb are the n entries of names (NAMES reply, nul separated
+ * "[@%+]nick"): they replace the old ones, sorted and indexed at once.
+ */
+void
+nick_load(ChanBuf *cb, const char *names, int n)
+{
+     NickStruct *ns, *next, *old, **a;
+     const char *p;
+     char rang;
+     int i, m, size;
 
-     if(strchr("@+%", nick[0]))
+     if(!cb || !cb->session || cb == hftirc.statuscb)
+          return;
+
+     /* Old members are freed last, users on both keep their record */
+     old = cb->nickhead;
+
+     cb->nickhead = cb->nickroot = NULL;
+     cb->nnick = 0;
+
+     for(size = 16; size <= n; size *= 2);
+
+     if(size > cb->nnicktab)
      {
-          ret->rang = nick[0];
-          strcpy(ret->nick, nick + 1);
+          free(cb->nicktab);
+          cb->nicktab = xmalloc(size, sizeof(NickStruct*));
+          cb->nnicktab = size;
      }
-     else
-          strcpy(ret->nick, nick);
 
-     return ret;
+     memset(cb->nicktab, 0, cb->nnicktab * sizeof(NickStruct*));
+
+     a = xmalloc(MAX(n, 1), sizeof(NickStruct*));
+
+     for(i = m = 0, p = names; i < n; ++i, p += strlen(p) + 1)
+     {
+          rang = (*p && strchr("@+%", *p) ? *p++ : '\0');
+
+          if(!*p || nick_find(cb, p))
+               continue;
+
+          ns = nick_new(cb, p, rang);
+          nick_hash_add(cb, ns);
+          a[m++] = ns;
+     }
+
+     for(; old; old = next)
+     {
+          next = old->next;
+          nick_free(cb, old);
+     }
+
+     nick_sortcb = cb;
+     qsort(a, m, sizeof(NickStruct*), nick_qcmp);
+
+     cb->nickroot = nick_tree_build(a, 0, m, 0);
+     cb->nickhead = (m ? a[0] : NULL);
+     cb->nnick = m;
+
+     for(i = 0; i < m; ++i)
+     {
+          a[i]->prev = (i ? a[i - 1] : NULL);
+          a[i]->next = (i + 1 < m ? a[i + 1] : NULL);
+     }
+
+     free(a);
+
+     cb->umask |= UNickListMask;
+
+     return;
+}
+
+/* Mode (rank) change: the nick moves in the order */
+void
+nick_set_rang(ChanBuf *cb, NickStruct *nick, char rang)
+{
+     nick_unlink(cb, nick);
+     nick->rang = rang;
+     nick_link(cb, nick);
+
+     cb->umask |= UNickListMask;
+
+     return;
 }
 
+/* Order again after a casemapping change */
+void
+nick_reindex(ChanBuf *cb)
+{
+     NickStruct *ns, *next;
+
+     ns = cb->nickhead;
+
+     cb->nickhead = cb->nickroot = NULL;
+     cb->nnick = 0;
+
+     if(cb->nnicktab)
+          memset(cb->nicktab, 0, cb->nnicktab * sizeof(NickStruct*));
+
+     for(; ns; ns = next)
+     {
+          next = ns->next;
+          nick_hash_add(cb, ns);
+          nick_link(cb, ns);
+          ++cb->nnick;
+     }
+
+     return;
+}
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Buffer scrollback.
+ *
+ * Lines are records (time, kind, rank, nick color, nick, text) formatted only when
+ * drawn, see ui_line_format().  Nick and text are packed back to back in
+ * a FIFO list of fixed size chunks, a growing ring of ScrollLine points
+ * into them.  Nothing is allocated
+ * before the first line; the oldest lines are dropped when the buffer
+ * goes over scrollback_lines or scrollback_size (see [misc]), and a chunk
+ * is released (kept as spare) once its last line is gone.
+ *
+ * With scrollback_spill, dropped lines are appended to a deleted file
+ * instead, and an index file gets the offset of each of them.  Both
+ * are mapped read only when a spilled line is wanted, so only the pages
+ * of the lines actually drawn are read, and line i is found in O(1).
+ */
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+
+#include "hftirc.h"
+
+#define SCROLLRING (32)
+
+/* Arena bytes used by a line */
+#define SCROLLSIZE(l) ((l)->nicklen + (l)->len + 2)
+
+/* Spilled line header, followed by nick and text (nul terminated) */
+typedef struct
+{
+     unsigned long seq;
+     long time;
+     unsigned int len;
+     unsigned char nicklen;
+     char kind, rank, color;
+} ScrollRec;
+
+static ScrollChunk*
+scroll_chunk(Scroll *s)
+{
+     ScrollChunk *c;
+
+     if((c = s->spare))
+          s->spare = NULL;
+     else
+          c = xmalloc(1, sizeof(ScrollChunk));
+
+     c->used = 0;
+     c->next = NULL;
+
+     if(s->tail)
+          s->tail->next = c;
+     else
+          s->head = c;
+
+     s->tail = c;
+
+     return c;
+}
+
+static Bool
+scroll_spill_open(Scroll *s)
+{
+     char path[FILENAME_MAX + 1];
+     int fd[2], i;
+
+     for(i = 0; i < 2; ++i)
+     {
+          snprintf(path, sizeof(path), "%s/hftirc.XXXXXX", hftirc.conf.spilldir);
+
+          if((fd[i] = mkstemp(path)) < 0)
+          {
+               if(i)
+                    close(fd[0]);
+
+               /* Don't try again on each line */
+               hftirc.conf.spill = False;
+
+               return False;
+          }
+
+          unlink(path);
+          fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+     }
+
+     s->spill = xcalloc(1, sizeof(ScrollSpill));
+     s->spill->fd = fd[0];
+     s->spill->ifd = fd[1];
+
+     return True;
+}
+
+/* Append a line to the spill files, False if it can't be kept */
+static Bool
+scroll_spill(Scroll *s, ScrollLine *l)
+{
+     ScrollSpill *sp;
+     ScrollRec r;
+     struct iovec iov[2];
+     unsigned long idx;
+     ssize_t len = sizeof(r) + SCROLLSIZE(l);
+
+     if(!hftirc.conf.spill || (!s->spill && !scroll_spill_open(s)))
+          return False;
+
+     sp = s->spill;
+     idx = sp->size;
+
+     memset(&r, 0, sizeof(r));
+     r.seq = l->seq;
+     r.time = l->time;
+     r.len = l->len;
+     r.nicklen = l->nicklen;
+     r.kind = l->kind;
+     r.rank = l->rank;
+     r.color = l->color;
+
+     /* nick and text are contiguous in the arena */
+     iov[0].iov_base = (void*)&r;
+     iov[0].iov_len = sizeof(r);
+     iov[1].iov_base = l->nick;
+     iov[1].iov_len = SCROLLSIZE(l);
+
+     if(writev(sp->fd, iov, 2) != len
+               || write(sp->ifd, &idx, sizeof(idx)) != sizeof(idx))
+     {
+          /* Keep both files consistent */
+          ftruncate(sp->fd, sp->size);
+          ftruncate(sp->ifd, sp->n * sizeof(idx));
+
+          return False;
+     }
+
+     sp->size += len;
+     ++sp->n;
+
+     return True;
+}
+
+/* (Re)map a spill file so that its first len bytes are readable */
+static void*
+scroll_spill_map(int fd, void *map, size_t *maplen, size_t len)
+{
+     if(len <= *maplen)
+          return map;
+
+     if(map)
+          munmap(map, *maplen);
+
+     /* Map ahead of the file end, it's only address space */
+     *maplen = len * 2;
+
+     if((map = mmap(NULL, *maplen, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+     {
+          *maplen = 0;
+          return NULL;
+     }
+
+     return map;
+}
+
+static ScrollLine*
+scroll_spill_line(Scroll *s, unsigned int i)
+{
+     ScrollSpill *sp = s->spill;
+     ScrollRec r;
+     char *p;
+
+     sp->imap = scroll_spill_map(sp->ifd, sp->imap, &sp->imaplen, sp->n * sizeof(unsigned long));
+     sp->map = scroll_spill_map(sp->fd, sp->map, &sp->maplen, sp->size);
+
+     if(!sp->imap || !sp->map)
+          return NULL;
+
+     /* Records are not aligned */
+     p = sp->map + sp->imap[i];
+     memcpy(&r, p, sizeof(r));
+
+     s->tmp.nick = p + sizeof(r);
+     s->tmp.text = s->tmp.nick + r.nicklen + 1;
+     s->tmp.len = r.len;
+     s->tmp.nicklen = r.nicklen;
+     s->tmp.seq = r.seq;
+     s->tmp.time = r.time;
+     s->tmp.kind = r.kind;
+     s->tmp.rank = r.rank;
+     s->tmp.color = r.color;
+     s->tmp.chunk = NULL;
+
+     return &s->tmp;
+}
+
+/* Drop the oldest line from memory */
+static void
+scroll_shift(Scroll *s)
+{
+     ScrollChunk *c;
+
+     if(!scroll_spill(s, &s->line[s->first]))
+          --s->n;
+
+     s->bytes -= SCROLLSIZE(&s->line[s->first]);
+     s->first = (s->first + 1) % s->size;
+
+     if(!--s->nram)
+     {
+          /* Keep the last chunk for the next lines */
+          while(s->head != s->tail)
+          {
+               c = s->head;
+               s->head = c->next;
+               free(c);
+          }
+
+          s->tail->used = 0;
+
+          return;
+     }
+
+     /* Release chunks the remaining lines don't use anymore */
+     while(s->head != s->line[s->first].chunk)
+     {
+          c = s->head;
+          s->head = c->next;
+
+          if(s->spare)
+               free(c);
+          else
+               s->spare = c;
+     }
+
+     return;
+}
+
+/* Grow the ring up to the line limit, keeping the oldest line at 0 */
+static Bool
+scroll_grow(Scroll *s)
+{
+     ScrollLine *l;
+     unsigned int size, i;
+
+     if(s->size >= hftirc.conf.scrolllines)
+          return False;
+
+     size = (s->size ? s->size * 2 : SCROLLRING);
+
+     if(size > hftirc.conf.scrolllines)
+          size = hftirc.conf.scrolllines;
+
+     l = xmalloc(size, sizeof(ScrollLine));
+
+     for(i = 0; i < s->nram; ++i)
+          l[i] = s->line[(s->first + i) % s->size];
+
+     free(s->line);
+
+     s->line = l;
+     s->size = size;
+     s->first = 0;
+
+     return True;
+}
+
+/* Append a copy of record r: r->nick (may be NULL) and r->len bytes of
+ * r->text are copied, nul terminated.  A line must fit in one chunk:
+ * longer text is cut, before a UTF-8 sequence the limit would split.
+ */
+ScrollLine*
+scroll_add(Scroll *s, ScrollLine *r)
+{
+     ScrollChunk *c;
+     ScrollLine *l;
+     size_t nicklen = (r->nick ? strlen(r->nick) : 0);
+     size_t len = r->len;
+     int i;
+
+     if(nicklen > NICKLEN)
+          nicklen = NICKLEN;
+
+     if(nicklen + len + 2 > SCROLLCHUNK)
+     {
+          len = SCROLLCHUNK - nicklen - 2;
+
+          /* A continuation byte at the cut: cut before its lead byte */
+          for(i = 0; i < 3 && len && (r->text[len] & 0xC0) == 0x80; ++i)
+               --len;
+     }
+
+     while(s->nram && s->bytes + nicklen + len + 2 > hftirc.conf.scrollsize)
+          scroll_shift(s);
+
+     if(s->nram == s->size && !scroll_grow(s))
+          scroll_shift(s);
+
+     if(!(c = s->tail) || c->used + nicklen + len + 2 > SCROLLCHUNK)
+          c = scroll_chunk(s);
+
+     ++s->n;
+     l = &s->line[(s->first + s->nram++) % s->size];
+     *l = *r;
+     l->nick = c->data + c->used;
+     l->nicklen = nicklen;
+     l->text = l->nick + nicklen + 1;
+     l->len = len;
+     l->chunk = c;
+
+     memcpy(l->nick, (r->nick ? r->nick : ""), nicklen);
+     l->nick[nicklen] = '\0';
+     memcpy(l->text, r->text, len);
+     l->text[len] = '\0';
+
+     c->used += SCROLLSIZE(l);
+     s->bytes += SCROLLSIZE(l);
+
+     return l;
+}
+
+/* Line i, 0 being the oldest one (spilled lines included).
+ * A spilled line is only valid until the next call.
+ */
+ScrollLine*
+scroll_line(Scroll *s, unsigned int i)
+{
+     if(i >= s->n)
+          return NULL;
+
+     if(s->spill)
+     {
+          if(i < s->spill->n)
+               return scroll_spill_line(s, i);
+
+          i -= s->spill->n;
+     }
+
+     return &s->line[(s->first + i) % s->size];
+}
+
+void
+scroll_free(Scroll *s)
+{
+     ScrollChunk *c;
+
+     while((c = s->head))
+     {
+          s->head = c->next;
+          free(c);
+     }
+
+     free(s->spare);
+     free(s->line);
+
+     if(s->spill)
+     {
+          if(s->spill->map)
+               munmap(s->spill->map, s->spill->maplen);
+          if(s->spill->imap)
+               munmap(s->spill->imap, s->spill->imaplen);
+
+          close(s->spill->fd);
+          close(s->spill->ifd);
+          free(s->spill);
+     }
+
+     memset(s, 0, sizeof(Scroll));
+
+     return;
+}
@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <fcntl.h>
+
 #include "hftirc.h"
 #include "ui.h"
 
@@ -36,14 +38,27 @@ ui_init(void)
      }
 
      setlocale(LC_ALL, "");
-     initscr();
+
+     /* Own terminal (first start), else the terminal given by ui_attach() */
+     if(!hftirc.ui.screen)
+     {
+          if(!(hftirc.ui.screen = newterm(NULL, stdout, stdin)))
+               errx(EXIT_FAILURE, "Can't initialize terminal");
+
+          hftirc.ui.infd = STDIN_FILENO;
+          hftirc.ui.owntty = True;
+     }
+
+     set_term(hftirc.ui.screen);
+     hftirc.ui.attached = True;
+
      raw();
      noecho();
      keypad(stdscr, TRUE);
      curs_set(FALSE);
 
      /* Check the termnial size */
-     if((LINES < 15 || COLS < 35) && hftirc.running == 1)
+     if((LINES < 15 || COLS < 35) && hftirc.running == 1 && hftirc.ui.owntty)
      {
           endwin();
           fprintf(stderr, "HFTIrc error: Terminal too small (%dx%d)\n"
@@ -57,9 +72,6 @@ ui_init(void)
      else
           hftirc.running = 2;
 
-     /* Input buffer stuff */
-     hftirc.ui.ib.split = 0;
-
      /* Color support */
      if(has_colors())
           ui_init_color();
@@ -69,6 +81,11 @@ ui_init(void)
      scrollok(hftirc.ui.mainwin, TRUE);
      wrefresh(hftirc.ui.mainwin);
 
+     /* New windows: status and topic bars have to be drawn */
+     memset(&hftirc.ui.status, 0, sizeof(StatusBar));
+     hftirc.ui.statusmod = True;
+     hftirc.ui.topic[0] = '\0';
+
      /* Init topic window */
      hftirc.ui.topicwin = newwin(1, COLS, 0, 0);
      wbkgd(hftirc.ui.topicwin, COLOR_SW);
@@ -76,13 +93,14 @@ ui_init(void)
 
      /* Init nicklist window */
      hftirc.ui.nicklistwin = newwin(LINES - 3, ROSTERSIZE, 1, COLS - ROSTERSIZE);
+     hftirc.ui.nnickrow = 0;
      wrefresh(hftirc.ui.nicklistwin);
 
      /* Init input window */
      hftirc.ui.inputwin = newwin(1, COLS, LINES - 1, 0);
-     wmove(hftirc.ui.inputwin, 0, 0);
-     hftirc.ui.ib.nhisto = 1;
+     edit_redraw();
      hftirc.ui.ib.histpos = 0;
+     hftirc.ui.ib.search = False;
      wrefresh(hftirc.ui.inputwin);
 
      /* Init status window (with the hour / current chan) */
@@ -95,21 +113,44 @@ ui_init(void)
      return;
 }
 
+/* Forget the decoded lines of every buffer: their attributes hold
+ * color pair numbers of a table that is about to be rebuilt.
+ */
+static void
+ui_draw_forget(void)
+{
+     int i, n;
+
+     for(i = 0; i < hftirc.nbuf; ++i)
+          if(hftirc.cb[i] && hftirc.cb[i]->draw)
+               for(n = 0; n < DRAWCACHE; ++n)
+               {
+                    FREEPTR(&hftirc.cb[i]->draw[n].span);
+                    hftirc.cb[i]->draw[n].seq = 0;
+               }
+
+     return;
+}
+
+/* Color pairs are allocated by ui_color() when first used and kept as
+ * long as the screen lives, so attributes cached in the draw caches stay
+ * valid across ui_init(); a new terminal starts with an empty table.
+ */
 void
 ui_init_color(void)
 {
-     int i, j, n = 0;
-
      start_color();
 
      hftirc.ui.bg = ((use_default_colors() == OK) ? -1 : COLOR_BLACK);
-     hftirc.ui.c = 1;
 
-     for(i = 0; i < COLORS; ++i)
-          for(j = 0; j < COLORS; ++j)
-               init_pair(++n, i, (!j ? hftirc.ui.bg : j));
+     if(hftirc.ui.pairs)
+          return;
+
+     hftirc.ui.c = 0;
+     hftirc.ui.ncolors = MIN(COLORS, 256);
+     hftirc.ui.pairs = xcalloc((hftirc.ui.ncolors + 1) * (hftirc.ui.ncolors + 1), sizeof(short));
 
-     hftirc.ui.c = n;
+     ui_draw_forget();
 
      return;
 }
@@ -117,28 +158,312 @@ ui_init_color(void)
 int
 ui_color(int fg, int bg)
 {
-     int i;
-     short f, b;
+     short *p;
 
      if(bg == COLOR_BLACK && hftirc.ui.bg != COLOR_BLACK)
           bg = hftirc.ui.bg;
 
-     for(i = 0; i < hftirc.ui.c + 1; ++i)
-          if(pair_content(i, &f, &b) == OK && f == fg && b == bg)
-               return COLOR_PAIR(i);
+     if(!hftirc.ui.pairs
+               || fg < -1 || fg >= hftirc.ui.ncolors
+               || bg < -1 || bg >= hftirc.ui.ncolors)
+          return 0;
+
+     p = &hftirc.ui.pairs[(fg + 1) * (hftirc.ui.ncolors + 1) + bg + 1];
+
+     /* Pair numbers must fit in the attributes */
+     if(!*p)
+     {
+          if(hftirc.ui.c >= MIN(COLOR_PAIRS - 1, PAIR_NUMBER(A_COLOR))
+                    || init_pair(hftirc.ui.c + 1, fg, bg) != OK)
+               return 0;
+
+          *p = ++hftirc.ui.c;
+     }
+
+     return COLOR_PAIR(*p);
+}
+
+/* Attributes of mIRC colors fg on bg: 0-15 are the basic colors, 16-98
+ * the extended ones (256 colors terminals only), 99 the default color.
+ */
+static attr_t
+ui_mirc_color(int fg, int bg)
+{
+     int f, b;
+     attr_t m = A_NORMAL;
+
+     if(fg == 99)
+          f = (hftirc.ui.bg == -1 ? -1 : COLOR_WHITE);
+     else if(fg >= COLORMAX && fg < 99 && hftirc.ui.ncolors >= 256)
+          f = mirc256[fg - COLORMAX];
+     else
+     {
+          f = mirccol[fg % COLORMAX].c;
+          m = mirccol[fg % COLORMAX].m;
+     }
+
+     if(bg == 99)
+          b = COLOR_BLACK;
+     else if(bg >= COLORMAX && bg < 99 && hftirc.ui.ncolors >= 256)
+          b = mirc256[bg - COLORMAX];
+     else
+          b = mirccol[bg % COLORMAX].c;
+
+     return ui_color(f, b) | m;
+}
+
+/* Put the windows changed since the last frame on screen with a single
+ * doupdate(), at most frame_rate times a second unless now is set (after
+ * input).  Return the microseconds to wait before the pending frame,
+ * -1 if there is none.
+ */
+long
+ui_frame(Bool now)
+{
+     struct timeval tv;
+     long wait;
+
+     if(!hftirc.ui.dirty || !hftirc.ui.attached)
+          return -1;
+
+     gettimeofday(&tv, NULL);
+
+     if(!now && hftirc.conf.framerate > 0)
+     {
+          wait = 1000000L / hftirc.conf.framerate
+               - ((tv.tv_sec - hftirc.ui.lastframe.tv_sec) * 1000000L
+                         + (tv.tv_usec - hftirc.ui.lastframe.tv_usec));
+
+          if(wait > 0)
+               return wait;
+     }
+
+     if(hftirc.ui.dirty & WMain)
+          wnoutrefresh(hftirc.ui.mainwin);
+
+     /* The last row of mainwin (empty, lines end with a newline) is
+      * under the status bar: stage the bar over it.
+      */
+     if(hftirc.ui.dirty & (WMain | WStatus))
+     {
+          touchwin(hftirc.ui.statuswin);
+          wnoutrefresh(hftirc.ui.statuswin);
+     }
+
+     if(hftirc.ui.dirty & WTopic)
+          wnoutrefresh(hftirc.ui.topicwin);
+
+     if(hftirc.ui.dirty & WNicklist)
+          wnoutrefresh(hftirc.ui.nicklistwin);
+
+     if(hftirc.ui.dirty & WInput)
+          wnoutrefresh(hftirc.ui.inputwin);
+
+     doupdate();
+
+     hftirc.ui.dirty = 0;
+     hftirc.ui.lastframe = tv;
+
+     return -1;
+}
+
+/* Activity index: a binary max-heap of the buffers with activity (but
+ * the status one), so the most urgent is always at heap[0]:
+ * private message > highlight > normal, then the latest one.
+ * cb->actpos is the slot of cb + 1, 0 if it has no activity.
+ */
+#define ACTRANK(cb) ((cb)->act == 2 ? (ISCHAN((cb)->name[0]) ? 2 : 3) : (cb)->act)
+
+static int
+ui_act_cmp(ChanBuf *a, ChanBuf *b)
+{
+     if(ACTRANK(a) != ACTRANK(b))
+          return ACTRANK(a) - ACTRANK(b);
+
+     return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+/* Most urgent first, for qsort() */
+static int
+ui_act_qcmp(const void *a, const void *b)
+{
+     return ui_act_cmp(*(ChanBuf**)b, *(ChanBuf**)a);
+}
+
+static void
+ui_act_place(ChanBuf *cb, int i)
+{
+     hftirc.act.heap[i] = cb;
+     cb->actpos = i + 1;
+
+     return;
+}
+
+static void
+ui_act_up(int i)
+{
+     ChanBuf *cb = hftirc.act.heap[i];
+
+     for(; i > 0 && ui_act_cmp(cb, hftirc.act.heap[(i - 1) / 2]) > 0; i = (i - 1) / 2)
+          ui_act_place(hftirc.act.heap[(i - 1) / 2], i);
+
+     ui_act_place(cb, i);
+
+     return;
+}
+
+static void
+ui_act_down(int i)
+{
+     ChanBuf *cb = hftirc.act.heap[i];
+     int c;
+
+     for(; (c = 2 * i + 1) < hftirc.act.n; i = c)
+     {
+          if(c + 1 < hftirc.act.n && ui_act_cmp(hftirc.act.heap[c + 1], hftirc.act.heap[c]) > 0)
+               ++c;
 
-     return 0;
+          if(ui_act_cmp(hftirc.act.heap[c], cb) <= 0)
+               break;
+
+          ui_act_place(hftirc.act.heap[c], i);
+     }
+
+     ui_act_place(cb, i);
+
+     return;
 }
 
+/* Set the activity of cb (0: none, 1: normal, 2: highlight), O(log n) */
+void
+ui_buf_act(ChanBuf *cb, int act)
+{
+     ChanBuf *last;
+     int i;
+
+     if(!cb)
+          return;
+
+     cb->act = act;
+
+     if(cb == hftirc.statuscb)
+          return;
+
+     hftirc.act.dirty = True;
+     hftirc.ui.statusmod = True;
+
+     /* Remove it: the last one takes its slot */
+     if(!act)
+     {
+          if(!cb->actpos)
+               return;
+
+          i = cb->actpos - 1;
+          cb->actpos = 0;
+          last = hftirc.act.heap[--hftirc.act.n];
+
+          if(i < hftirc.act.n)
+          {
+               ui_act_place(last, i);
+               ui_act_up(i);
+               ui_act_down(last->actpos - 1);
+          }
+
+          return;
+     }
+
+     if(!cb->actpos)
+     {
+          if(hftirc.act.n == hftirc.act.max)
+          {
+               hftirc.act.max = (hftirc.act.max ? hftirc.act.max * 2 : 16);
+               hftirc.act.heap = xrealloc(hftirc.act.heap, hftirc.act.max, sizeof(ChanBuf*));
+               hftirc.act.sorted = xrealloc(hftirc.act.sorted, hftirc.act.max, sizeof(ChanBuf*));
+          }
+
+          ui_act_place(cb, hftirc.act.n++);
+     }
+
+     ui_act_up(cb->actpos - 1);
+     ui_act_down(cb->actpos - 1);
+
+     return;
+}
+
+/* Jump to the most urgent buffer with activity */
+void
+ui_buf_urgent(void)
+{
+     if(hftirc.act.n)
+          ui_buf_set(hftirc.act.heap[0]->id);
+
+     return;
+}
+
+/* Fill m with what the status bar has to show */
+static void
+ui_status_model(StatusBar *m)
+{
+     ChanBuf *act;
+     int i, n;
+     IrcSession *s = hftirc.selsession;
+
+     memset(m, 0, sizeof(StatusBar));
+
+     snprintf(m->date, sizeof(m->date), "%s", hftirc.date.str);
+     snprintf(m->nick, sizeof(m->nick), "%s", (s->nick ? s->nick : ""));
+     snprintf(m->mode, sizeof(m->mode), "%s", (s->mode ? s->mode : ""));
+     snprintf(m->serv, sizeof(m->serv), "%s", (s->name ? s->name : ""));
+     snprintf(m->name, sizeof(m->name), "%s", hftirc.selcb->name);
+     m->id = hftirc.selcb->id;
+     m->tcolor = hftirc.ui.tcolor;
+     m->connected = s->connected;
+
+     /* Active buffers only, most urgent first; sorted again only when
+      * an activity changed */
+     if(hftirc.act.dirty && hftirc.act.n)
+     {
+          memcpy(hftirc.act.sorted, hftirc.act.heap, hftirc.act.n * sizeof(ChanBuf*));
+          qsort(hftirc.act.sorted, hftirc.act.n, sizeof(ChanBuf*), ui_act_qcmp);
+          hftirc.act.dirty = False;
+     }
+
+     for(i = 0; i < hftirc.act.n; ++i)
+     {
+          act = hftirc.act.sorted[i];
+          n = snprintf(m->act + m->actlen, BUFSIZE - m->actlen, "%c%d:%s",
+                    (act->act == 2 ? '2' : '1'), act->id, act->name);
+
+          if(n < 0 || m->actlen + n + 1 >= BUFSIZE)
+               break;
+
+          m->actlen += n + 1;
+     }
+
+     return;
+}
+
+/* Rebuilt only when flagged by statusmod (activity, selection, date,
+ * session...), redrawn only if what it shows really changed */
 void
 ui_update_statuswin(void)
 {
-     int j, c, x, y;
-     ChanBuf *cb;
+     int x, y;
+     char *p;
+     StatusBar m;
 
-     if(!hftirc.selcb)
+     if(!hftirc.selcb || !hftirc.ui.attached || !hftirc.ui.statusmod)
           return;
 
+     hftirc.ui.statusmod = False;
+
+     ui_status_model(&m);
+
+     if(!memcmp(&m, &hftirc.ui.status, sizeof(StatusBar)))
+          return;
+
+     hftirc.ui.status = m;
+
      /* Erase all window content */
      werase(hftirc.ui.statuswin);
 
@@ -146,50 +471,41 @@ ui_update_statuswin(void)
      wbkgd(hftirc.ui.statuswin, COLOR_SW);
 
      /* Print date */
-     mvwprintw(hftirc.ui.statuswin, 0, 0, "[%s]", hftirc.date.str);
+     mvwprintw(hftirc.ui.statuswin, 0, 0, "[%s]", m.date);
 
      /* Pseudo with mode */
-     mvwprintw(hftirc.ui.statuswin, 0, strlen(hftirc.date.str) + 3, "(");
-     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, hftirc.selsession->nick);
+     mvwprintw(hftirc.ui.statuswin, 0, strlen(m.date) + 3, "(");
+     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, m.nick);
      waddch(hftirc.ui.statuswin, '(');
-     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, hftirc.selsession->mode);
+     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, m.mode);
      waddstr(hftirc.ui.statuswin, "))");
 
      /* Info about current serv/channel */
-     wprintw(hftirc.ui.statuswin, " (%d:", hftirc.selcb->id);
-     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2,  hftirc.selsession->name);
+     wprintw(hftirc.ui.statuswin, " (%d:", m.id);
+     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, m.serv);
 
-     if(!hftirc.selsession->connected)
+     if(!m.connected)
           PRINTATTR(hftirc.ui.statuswin, A_BOLD, " (Disconnected)");
 
      waddch(hftirc.ui.statuswin, '/');
-     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, hftirc.selcb->name);
+     PRINTATTR(hftirc.ui.statuswin, COLOR_SW2, m.name);
      waddch(hftirc.ui.statuswin, ')');
 
      /* Activity */
      wprintw(hftirc.ui.statuswin, " (Bufact: ");
 
-     /* First pritority is when ISCHAN(..) == 0, second for == j.
-      * Priority: Private conversation, highlight channel, and normal active channel.
-      */
-     for(j = 0; j < 2; ++j)
-          for ( c = 2; c > 0; --c )
-               for(cb = hftirc.cbhead; cb; cb = cb->next)
-                    if(ISCHAN(cb->name[0]) == j && cb->act == c && cb != hftirc.statuscb)
-                    {
-                         wattron(hftirc.ui.statuswin, ((c == 2) ? COLOR_HLACT : COLOR_ACT));
-                         wprintw(hftirc.ui.statuswin, "%d", cb->id);
-                         wprintw(hftirc.ui.statuswin, ":%s", cb->name);
-                         wattroff(hftirc.ui.statuswin, ((c == 2) ? COLOR_HLACT : COLOR_ACT));
-                         waddch(hftirc.ui.statuswin, ' ');
-                    }
+     for(p = m.act; p < m.act + m.actlen; p += strlen(p) + 1)
+     {
+          PRINTATTR(hftirc.ui.statuswin, ((*p == '2') ? COLOR_HLACT : COLOR_ACT), p + 1);
+          waddch(hftirc.ui.statuswin, ' ');
+     }
 
      /* Remove last char in () -> a space and put the ) instead it */
      getyx(hftirc.ui.statuswin, x, y);
      wmove(hftirc.ui.statuswin, x, y - 1);
      waddch(hftirc.ui.statuswin, ')');
 
-     wrefresh(hftirc.ui.statuswin);
+     hftirc.ui.dirty |= WStatus;
 
      return;
 }
@@ -197,28 +513,37 @@ ui_update_statuswin(void)
 void
 ui_update_topicwin(void)
 {
+     char topic[BUFSIZE];
+
      /* Check if this is needed */
-     if(!hftirc.selcb || !(hftirc.selcb->umask & UTopicMask))
+     if(!hftirc.selcb || !hftirc.ui.attached || !(hftirc.selcb->umask & UTopicMask))
+          return;
+
+     hftirc.selcb->umask &= ~UTopicMask;
+
+     /* Topic of a channel, else name of the buffer; the theme color
+      * goes first so that changing it redraws the bar.
+      */
+     if(ISCHAN(hftirc.selcb->name[0]))
+          snprintf(topic, sizeof(topic), "%c%s", hftirc.ui.tcolor + '1', hftirc.selcb->topic);
+     else
+          snprintf(topic, sizeof(topic), "%c%s (%s)", hftirc.ui.tcolor + '1',
+                    hftirc.selcb->name, hftirc.selsession->name);
+
+     if(!strcmp(topic, hftirc.ui.topic))
           return;
 
+     strcpy(hftirc.ui.topic, topic);
+
      /* Erase all window content */
      werase(hftirc.ui.topicwin);
 
      /* Update bg color */
      wbkgd(hftirc.ui.topicwin, COLOR_SW);
 
-     /* Write topic */
-     /*   Channel   */
-     if(ISCHAN(hftirc.selcb->name[0]))
-          waddstr(hftirc.ui.topicwin, hftirc.selcb->topic);
-     /*   Other    */
-     else
-          wprintw(hftirc.ui.topicwin, "%s (%s)",
-                    hftirc.selcb->name, hftirc.selsession->name);
-
-     wrefresh(hftirc.ui.topicwin);
+     waddstr(hftirc.ui.topicwin, topic + 1);
 
-     hftirc.selcb->umask &= ~UTopicMask;
+     hftirc.ui.dirty |= WTopic;
 
      return;
 }
@@ -226,78 +551,142 @@ ui_update_topicwin(void)
 void
 ui_update_nicklistwin(void)
 {
-     int i, c, p;
-     char ord[4] = { '@', '%', '+', '\0' };
+     int i, rows = LINES - 3;
+     char row[NICKLEN + 2];
      NickStruct *ns;
+     WINDOW *w = hftirc.ui.nicklistwin;
 
      if(!hftirc.selcb)
           return;
 
-     nick_sort_abc(hftirc.selcb);
-
-     if(!hftirc.ui.nicklist
+     if(!hftirc.ui.nicklist || !hftirc.ui.attached
                || !(hftirc.selcb->umask & UNickListMask))
           return;
 
-     werase(hftirc.ui.nicklistwin);
+     /* New window: | separation bar, then every row */
+     if(hftirc.ui.nnickrow != rows)
+     {
+          free(hftirc.ui.nickrow);
+          hftirc.ui.nickrow = xcalloc(rows, sizeof(*hftirc.ui.nickrow));
+          hftirc.ui.nnickrow = rows;
+
+          werase(w);
+          wattron(w, COLOR_ROSTER);
 
-     /* Travel in nick linked list */
-     /* Order with [ord]:
+          for(i = 0; i < rows; ++i)
+               mvwaddch(w, i, 0, ACS_VLINE);
+
+          wattroff(w, COLOR_ROSTER);
+
+          hftirc.ui.dirty |= WNicklist;
+     }
+
+     /* The nick list is kept in order:
       *  | @foo
       *  | %foo
       *  | +foo
       *  |  foo
+      * only the rows shown are walked, and only the ones that changed
+      * are drawn: the cost doesn't depend on the size of the channel.
       */
-     for(i = c = p = 0; i < LEN(ord); ++i)
+     for(i = 0, ns = nick_nth(hftirc.selcb, MAX(hftirc.selcb->nicklistscroll, 0)); i < rows; ++i)
      {
-          for(ns = hftirc.selcb->nickhead;
-                    ns && c < ((LINES - 3) + hftirc.selcb->nicklistscroll); /* </// Scroll limit */
-                    ns = ns->next)
-          {
-               if(ns->rang == ord[i])
-               {
-                    if(p >= hftirc.selcb->nicklistscroll)
-                         wprintw(hftirc.ui.nicklistwin, " %c%s\n", (ns->rang ? ns->rang : ' '), ns->nick);
+          row[0] = '\0';
 
-                    ++c;
-                    ++p;
-               }
+          if(ns)
+          {
+               sprintf(row, "%c%s", (ns->rang ? ns->rang : ' '), ns->nick);
+               ns = ns->next;
           }
-     }
 
-     /* Draw | separation bar */
-     wattron(hftirc.ui.nicklistwin, COLOR_ROSTER);
+          if(!strcmp(row, hftirc.ui.nickrow[i]))
+               continue;
 
-     for(i = 0; i < LINES - 3; ++i)
-          mvwaddch(hftirc.ui.nicklistwin, i, 0, ACS_VLINE);
+          strcpy(hftirc.ui.nickrow[i], row);
 
-     wattroff(hftirc.ui.nicklistwin, COLOR_ROSTER);
+          wmove(w, i, 1);
+          wclrtoeol(w);
+          waddnstr(w, row, ROSTERSIZE - 1);
 
-     wrefresh(hftirc.ui.nicklistwin);
+          hftirc.ui.dirty |= WNicklist;
+     }
 
      hftirc.selcb->umask &= ~UNickListMask;
 
      return;
 }
 
-void
-ui_print(WINDOW *w, char *str, int n)
+/* Length of the text at the start of s (len bytes at most) without
+ * any byte < 0x20, so without formatting code.
+ */
+static int
+ui_textrun(const char *s, int len)
 {
-     int i;
+     int i = 0;
+#ifdef __SSE2__
+     __m128i v, lim = _mm_set1_epi8(0x1F);
+     int m;
+
+     /* 16 bytes at a time: c < 0x20 <=> min(c, 0x1F) == c */
+     for(; i + 16 <= len; i += 16)
+     {
+          v = _mm_loadu_si128((const __m128i*)(s + i));
+
+          if((m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, lim), v))))
+          {
+               while(!(m & 1))
+               {
+                    m >>= 1;
+                    ++i;
+               }
+
+               return i;
+          }
+     }
+#else
+     unsigned long w;
+     const unsigned long ones = (unsigned long)-1 / 0xFF;
+
+     /* A word at a time: some byte < 0x20 if (w - 0x20..) & ~w & 0x80.. */
+     for(; i + (int)sizeof(w) <= len; i += sizeof(w))
+     {
+          memcpy(&w, s + i, sizeof(w));
+
+          if((w - ones * 0x20) & ~w & (ones * 0x80))
+               break;
+     }
+#endif /* __SSE2__ */
+
+     for(; i < len && (unsigned char)s[i] >= 0x20; ++i);
+
+     return i;
+}
+
+/* Decode bold/underline/reverse, HFTIrc and mIRC color codes of str:
+ * text gets str without the codes (UTF-8 decoded), span its attribute
+ * runs and width its number of columns.
+ * After DRAWSPANS runs, attributes changes are ignored so that a line
+ * full of codes costs no more than DRAWSPANS curses calls.
+ * Return the number of spans.
+ */
+static unsigned int
+ui_decode(const char *str, wchar_t *text, DrawSpan *span, unsigned int *width)
+{
+     int i, j, len, r, w, t = 0, t0;
+     unsigned int n = 0;
+     wchar_t wc;
+     attr_t a;
      unsigned int hmask = A_NORMAL;
      unsigned int mask = A_NORMAL;
-     unsigned int lastposmask = A_NORMAL;
      unsigned int colmask = A_NORMAL;
-     int fg = 15, bg  = 1, mcol = 0, lcol = 0;
+     int fg = 15, bg  = 1, mcol, lcol = 0;
 
-     if(!str || !w)
-          return;
+     if((len = strlen(str)) > BUFFERSIZE)
+          len = BUFFERSIZE;
 
-     /* Last position tracker with bold line */
-     if(hftirc.conf.lastlinepos && hftirc.selcb->lastposbold == n)
-          lastposmask |= COLOR_LASTPOS;
+     *width = 0;
 
-     for(i = 0; i < (strlen(str) < BUFFERSIZE ? strlen(str) : BUFFERSIZE); ++i)
+     for(i = 0; i < len; ++i)
      {
           switch(str[i])
           {
@@ -332,18 +721,20 @@ ui_print(WINDOW *w, char *str, int n)
                          if(isdigit(str[i + 1]))
                               fg = fg * 10 + (str[++i] - '0');
 
-                         if(fg > -1 && fg < 16)
+                         if(fg > -1 && fg < 16 && n < DRAWSPANS)
                               colmask ^= (ui_color(hftirccol[fg].c, hftirc.ui.bg) | hftirccol[fg].m);
 
                          fg = 0;
                     }
                     break;
 
-               /* mIRC©®™ colors */
+               /* mIRC©®™ colors, a lone ^C ends the color */
                case MIRC_COLOR:
-                    if(lcol)
+                    if(lcol && n < DRAWSPANS)
                         hmask &= ~lcol;
 
+                    mcol = 0;
+
                     /* Set fg color first if there is no coma */
                     if(isdigit(str[i + 1]))
                     {
@@ -361,28 +752,249 @@ ui_print(WINDOW *w, char *str, int n)
                          bg = (str[i + 2] - '0');
                          i += 2;
 
-                         if(isdigit(str[i + 1]))
-                              bg = bg * 10 + (str[++i] - '0');
+                         if(isdigit(str[i + 1]))
+                              bg = bg * 10 + (str[++i] - '0');
+
+                         if(fg == bg)
+                              fg = 1;
+                         mcol = 1;
+                    }
+
+                    if(mcol && n < DRAWSPANS)
+                            hmask ^= (lcol = ui_mirc_color(fg, bg));
+
+                    break;
+
+               default:
+                    a = colmask | hmask | mask;
+
+                    /* Whole run up to the next control code at once */
+                    if(!(r = ui_textrun(str + i, len - i)))
+                         r = 1;
+
+                    for(j = i, t0 = t; j < i + r;)
+                    {
+                         /* ASCII: one byte, one column (\n, \t are left to curses) */
+                         if(!(str[j] & 0x80))
+                         {
+                              *width += ((unsigned char)str[j] >= 0x20);
+                              text[t++] = str[j++];
+                              continue;
+                         }
+
+                         j += utf8_decode(str + j, i + r - j, &wc);
+
+                         if((w = wc_width(wc)) < 0)
+                         {
+                              wc = '?';
+                              w = 1;
+                         }
+
+                         *width += w;
+                         text[t++] = wc;
+                    }
+
+                    /* Same attributes (or no span left): extend the current run */
+                    if(n && span[n - 1].off + span[n - 1].len == t0
+                              && (span[n - 1].attr == a || n == DRAWSPANS))
+                         span[n - 1].len += t - t0;
+                    else
+                    {
+                         span[n].off = t0;
+                         span[n].len = t - t0;
+                         span[n].attr = a;
+                         ++n;
+                    }
+
+                    i += r - 1;
+
+                    break;
+          }
+     }
+
+     text[t] = '\0';
+
+     return n;
+}
+
+static void
+ui_replay(WINDOW *w, DrawLine *d, attr_t extra)
+{
+     unsigned int i;
+
+     for(i = 0; i < d->nspan; ++i)
+     {
+          wattron(w, d->span[i].attr | extra);
+          waddnwstr(w, d->text + d->span[i].off, d->span[i].len);
+          wattroff(w, d->span[i].attr | extra);
+     }
+
+     return;
+}
+
+/* Attributes of the last line seen, see lastline_position */
+static attr_t
+ui_lastpos(unsigned long seq)
+{
+     if(hftirc.conf.lastlinepos && seq && hftirc.selcb->lastseen == seq)
+          return COLOR_LASTPOS;
+
+     return A_NORMAL;
+}
+
+void
+ui_print(WINDOW *w, char *str, unsigned long seq)
+{
+     static wchar_t text[BUFFERSIZE + 1];
+     static DrawSpan span[DRAWSPANS];
+     DrawLine d;
+
+     if(!str || !w)
+          return;
+
+     d.text = text;
+     d.span = span;
+     d.nspan = ui_decode(str, text, span, &d.width);
+
+     ui_replay(w, &d, ui_lastpos(seq));
+
+     return;
+}
+
+/* Decoded scrollback line of cb; lines are formatted and decoded once,
+ * then kept in a small cache indexed by sequence number.
+ */
+static DrawLine*
+ui_draw_get(ChanBuf *cb, ScrollLine *l)
+{
+     static wchar_t text[BUFFERSIZE + 1];
+     static DrawSpan span[DRAWSPANS];
+     char line[BUFFERSIZE];
+     DrawLine *d;
+     unsigned int n, len, width;
+
+     if(!cb->draw)
+          cb->draw = xcalloc(DRAWCACHE, sizeof(DrawLine));
+
+     d = &cb->draw[l->seq % DRAWCACHE];
+
+     if(d->seq != l->seq || !d->span)
+     {
+          ui_line_format(l, line, sizeof(line));
+          n = ui_decode(line, text, span, &width);
+          len = wcslen(text);
+
+          /* One block: spans then text */
+          free(d->span);
+          d->span = xmalloc(n * sizeof(DrawSpan) + (len + 1) * sizeof(wchar_t), 1);
+          d->text = (wchar_t*)(d->span + n);
+          d->nspan = n;
+          d->width = width;
+          d->seq = l->seq;
+
+          memcpy(d->span, span, n * sizeof(DrawSpan));
+          wmemcpy(d->text, text, len + 1);
+     }
+
+     return d;
+}
+
+static void
+ui_draw_line(ChanBuf *cb, ScrollLine *l)
+{
+     ui_replay(hftirc.ui.mainwin, ui_draw_get(cb, l), ui_lastpos(l->seq));
+
+     return;
+}
+
+/* Format a scrollback record to display it: date, body and \n */
+int
+ui_line_format(ScrollLine *l, char *buf, size_t size)
+{
+     int n;
+     char *date = date_str(l->time);
+     char rank[4] = { 0 };
+
+     if(l->rank)
+          sprintf(rank, "%c%c%c", B, l->rank, B);
+
+     switch(l->kind)
+     {
+          case LineMsg:
+               n = snprintf(buf, size, "%s <%s%s> %s\n", date, rank, nick_color(l->nick, l->color), l->text);
+               break;
+
+          /* Whole line colored: yellow for highlight, cyan for what we said */
+          case LineHl:
+          case LineSelf:
+               n = snprintf(buf, size, "%s %c%d<%s%s> %s%c\n", date, HFTIRC_COLOR,
+                         ((l->kind == LineHl) ? LightYellow : Cyan),
+                         rank, l->nick, l->text, HFTIRC_END_COLOR);
+               break;
+
+          case LinePriv:
+               n = snprintf(buf, size, "%s <%s> %s\n", date, l->nick, l->text);
+               break;
+
+          case LineAction:
+               n = snprintf(buf, size, "%s  %c* %s%c %s\n", date, B, l->nick, B, l->text);
+               break;
+
+          case LineHlAction:
+               n = snprintf(buf, size, "%s  %c%d%c* %s%c %s%c\n", date, HFTIRC_COLOR, LightYellow,
+                         B, l->nick, B, l->text, HFTIRC_END_COLOR);
+               break;
+
+          default:
+               n = snprintf(buf, size, "%s %s\n", date, l->text);
+               break;
+     }
+
+     /* Truncated: keep the \n */
+     if(n < 0 || n >= (int)size)
+     {
+          n = size - 1;
+          buf[n - 1] = '\n';
+          buf[n] = '\0';
+     }
+
+     return n;
+}
 
-                         if(fg == bg)
-                              fg = 1;
-                         mcol = 1;
-                    }
+/* Store a record in cb; it is only formatted if cb is shown */
+static void
+ui_buf_line(ChanBuf *cb, ScrollLine *r)
+{
+     ScrollLine *l;
 
-                    if(mcol)
-                            hmask ^= (lcol = (ui_color(mirccol[fg % COLORMAX].c, mirccol[bg % COLORMAX].c)
-                                           | mirccol[fg % COLORMAX].m));
+     r->seq = cb->seq = ++hftirc.lineseq;
+     r->time = hftirc.date.lt;
 
-                    break;
+     l = scroll_add(&cb->scroll, r);
 
-               default:
-                    /* simple waddch doesn't work with some char */
-                    wattron(w, colmask | hmask | mask | lastposmask);
-                    wprintw(w, "%c", str[i]);
-                    wattroff(w, colmask | hmask | mask | lastposmask);
+     /* Print on buffer if cb = selected buf */
+     if(cb == hftirc.selcb && !cb->scrollpos && hftirc.ui.attached)
+     {
+          ui_draw_line(cb, l);
+          hftirc.ui.dirty |= WMain;
+     }
 
-                    break;
-          }
+     /* Activity management:
+      *   1: Normal acitivity on the buffer (talking, info..)
+      *   2: Highlight activity on the buffer
+      */
+     if(cb != hftirc.selcb)
+     {
+          /* Highlight test (if hl or private message); messages were
+           * matched by their event, other lines against the nick of the
+           * session of cb.  No HL on status buffer (0).
+           */
+          if(cb != hftirc.statuscb
+                    && (l->kind == LineHl || l->kind == LineHlAction || !ISCHAN(cb->name[0])
+                         || (l->kind == LineText && highlight_match(cb->session, l->text))))
+               ui_buf_act(cb, 2);
+          else
+               ui_buf_act(cb, (cb->act == 2 ? 2 : 1));
      }
 
      return;
@@ -391,53 +1003,46 @@ ui_print(WINDOW *w, char *str, int n)
 void
 ui_print_buf(ChanBuf *cb, char *format, ...)
 {
-     int i, j;
+     int n;
      va_list ap;
-     char *p, *buf;
+     char text[BUFFERSIZE];
+     ScrollLine r;
 
-     if(!cb || !(p = calloc(BUFFERSIZE, sizeof(char))))
+     if(!cb)
           return;
 
-     /* Get format */
      va_start(ap, format);
-     vsnprintf(p, BUFFERSIZE, format, ap);
+     n = vsnprintf(text, sizeof(text), format, ap);
      va_end(ap);
 
-     /* Clean ...[part]... we need in buffer */
-     for(i = (j = cb->bufpos * BUFFERSIZE); i < BUFFERSIZE + j; cb->buffer[i++] = '\0');
+     memset(&r, 0, sizeof(r));
+     r.kind = LineText;
+     r.text = text;
+     r.len = ((n < 0 || n >= (int)sizeof(text)) ? sizeof(text) - 1 : (unsigned int)n);
 
-     /* Set buffer line */
-     snprintf(&cb->buffer[cb->bufpos * BUFFERSIZE], BUFFERSIZE, "%s %s\n", hftirc.date.str, p);
-     buf = &cb->buffer[cb->bufpos * BUFFERSIZE];
+     ui_buf_line(cb, &r);
 
-     /* New buffer position */
-     cb->bufpos = (cb->bufpos < BUFLINES - 1) ? cb->bufpos + 1 : 0;
+     return;
+}
 
-     /* Print on buffer if cb = selected buf */
-     if(cb == hftirc.selcb && !cb->scrollpos)
-     {
-          ui_print(hftirc.ui.mainwin, buf, 0);
-          wrefresh(hftirc.ui.mainwin);
-     }
+/* Message line, see LineMsg & co in hftirc.h */
+void
+ui_print_msg(ChanBuf *cb, int kind, char rank, int color, const char *nick, const char *text)
+{
+     ScrollLine r;
 
-     /* Activity management:
-      *   1: Normal acitivity on the buffer (talking, info..)
-      *   2: Highlight activity on the buffer
-      */
-     if(cb != hftirc.selcb)
-     {
-          if(cb->act != 2)
-               cb->act = 1;
-
-          /* Highlight test (if hl or private message) */
-          if(hftirc.conf.serv && cb && ((((strchr(buf, '<') && strchr(buf, '>')) || strchr(buf, '*'))
-           && strcasestr(buf + strlen(hftirc.date.str) + 4, hftirc.selsession->nick)) || !ISCHAN(cb->name[0])))
-               /* No HL on status buffer (0) */
-               cb->act = (cb != hftirc.statuscb) ? 2 : 1;
-     }
+     if(!cb)
+          return;
+
+     memset(&r, 0, sizeof(r));
+     r.kind = kind;
+     r.rank = rank;
+     r.color = color;
+     r.nick = (char*)nick;
+     r.text = (char*)text;
+     r.len = strlen(text);
 
-     buf = NULL;
-     FREEPTR(&p);
+     ui_buf_line(cb, &r);
 
      return;
 }
@@ -445,21 +1050,33 @@ ui_print_buf(ChanBuf *cb, char *format, ...)
 void
 ui_draw_buf(ChanBuf *cb)
 {
-     int i = 0;
+     int i, end, rows, cols;
+     ScrollLine *l;
+     DrawLine *d;
 
-     if(!cb)
+     if(!cb || !hftirc.ui.attached)
           return;
 
-     for(i = (cb->bufpos + cb->scrollpos) - MAINWIN_LINES; i < (cb->bufpos + cb->scrollpos); ++i)
-          if(i < BUFLINES)
-          {
-               if(i < 0 && cb->buffer[(BUFLINES + i) * BUFFERSIZE])
-                    ui_print(hftirc.ui.mainwin, &cb->buffer[(BUFLINES + i) * BUFFERSIZE], BUFLINES + i);
-               else
-                    ui_print(hftirc.ui.mainwin, ((i >= 0) ? &cb->buffer[i * BUFFERSIZE] : "\n"), i);
-          }
+     end = (int)cb->scroll.n + cb->scrollpos;
+     cols = getmaxx(hftirc.ui.mainwin);
 
-     wrefresh(hftirc.ui.mainwin);
+     /* Only draw the lines that fit, long lines take several rows */
+     for(i = end, rows = 0; i > 0 && rows < MAINWIN_LINES; rows += d->width / cols + 1)
+     {
+          if(!(l = scroll_line(&cb->scroll, --i)))
+               break;
+
+          d = ui_draw_get(cb, l);
+     }
+
+     for(; rows < MAINWIN_LINES; ++rows)
+          ui_print(hftirc.ui.mainwin, "\n", 0);
+
+     for(; i < end; ++i)
+          if(i >= 0 && (l = scroll_line(&cb->scroll, i)))
+               ui_draw_line(cb, l);
+
+     hftirc.ui.dirty |= WMain;
 
      return;
 }
@@ -470,18 +1087,15 @@ ui_draw_buf(ChanBuf *cb)
 void
 ui_buf_set(int buf)
 {
-     ChanBuf *c, *cb;
+     ChanBuf *cb;
 
      if(!(cb = find_buf_wid(buf)))
           return;
 
      if(hftirc.selcb)
      {
-          hftirc.selcb->lastposbold = hftirc.selcb->bufpos - 1;
-
-          /* Find selcb real pointer */
-          for(c = hftirc.cbhead; c && c != hftirc.selcb; c = c->next);
-          hftirc.prevcb = (hftirc.prevcb == hftirc.selcb ? hftirc.statuscb : c);
+          hftirc.selcb->lastseen = hftirc.selcb->seq;
+          hftirc.prevcb = (hftirc.prevcb == hftirc.selcb ? hftirc.statuscb : hftirc.selcb);
      }
      else
           hftirc.prevcb = hftirc.statuscb;
@@ -489,12 +1103,14 @@ ui_buf_set(int buf)
      /* Set selected cb */
      hftirc.selcb = cb;
 
-     cb->act = 0;
+     ui_buf_act(cb, 0);
      cb->umask |= (UTopicMask | UNickListMask);
 
      if(cb != hftirc.statuscb)
           hftirc.selsession = cb->session;
 
+     hftirc.ui.statusmod = True;
+
      ui_draw_buf(cb);
 
      return;
@@ -510,20 +1126,28 @@ ui_buf_new(const char *name, IrcSession *session)
 
      cb = (ChanBuf*)calloc(1, sizeof(ChanBuf));
 
-     HFTLIST_ATTACH_END(hftirc.cbhead, ChanBuf, cb);
-
-     cb->id = hftirc.nbuf++;
+     /* Last of the registry, its id is its slot */
+     if(hftirc.nbuf == hftirc.maxbuf)
+     {
+          hftirc.maxbuf = (hftirc.maxbuf ? hftirc.maxbuf * 2 : 32);
+          hftirc.cb = xrealloc(hftirc.cb, hftirc.maxbuf, sizeof(ChanBuf*));
+     }
 
-     cb->buffer = (char*)calloc(BUFLINES * BUFFERSIZE, sizeof(char));
+     cb->id = hftirc.nbuf;
+     hftirc.cb[hftirc.nbuf++] = cb;
 
+     /* Scrollback is allocated with the first line */
      strcpy(cb->name, name);
-     cb->bufpos = cb->scrollpos = cb->act = 0;
+     cb->scrollpos = cb->act = 0;
      cb->naming = cb->nicklistscroll = 0;
-     cb->lastposbold = -1;
+     cb->lastseen = 0;
      cb->session = session;
+     cb->charset = (session ? charset_conf(session->name, name) : NULL);
      cb->umask |= (UTopicMask | UNickListMask);
      cb->nickhead = NULL;
 
+     buf_hash_add(cb);
+
      if(ISCHAN(name[0]))
           ui_buf_set(cb->id);
 
@@ -533,8 +1157,6 @@ ui_buf_new(const char *name, IrcSession *session)
 void
 ui_buf_close(ChanBuf *cb)
 {
-     NickStruct *ns;
-     ChanBuf *c;
      int n;
 
      if(!cb || cb == hftirc.statuscb || cb->id > hftirc.nbuf - 1)
@@ -542,21 +1164,35 @@ ui_buf_close(ChanBuf *cb)
 
      --hftirc.nbuf;
 
+     ui_buf_act(cb, 0);
+     buf_hash_del(cb);
+
      /* Free nick of chan */
-     for(ns = cb->nickhead; ns; ns = ns->next)
-          nick_detach(cb, ns);
+     nick_clear(cb);
+     FREEPTR(&cb->nicktab);
+     FREEPTR(&cb->names.buf);
+     scroll_free(&cb->scroll);
+
+     if(cb->draw)
+          for(n = 0; n < DRAWCACHE; ++n)
+               free(cb->draw[n].span);
 
-     FREEPTR(&cb->nickhead);
-     FREEPTR(&cb->buffer);
+     FREEPTR(&cb->draw);
 
-     HFTLIST_DETACH(hftirc.cbhead, ChanBuf, cb);
+     /* Out of the registry: the next ones move down a slot */
+     memmove(&hftirc.cb[cb->id], &hftirc.cb[cb->id + 1], (hftirc.nbuf - cb->id) * sizeof(ChanBuf*));
 
-     /* Re-set id */
-     for(n = 0, c = hftirc.cbhead; c; c->id = n++, c = c->next);
+     for(n = cb->id; n < hftirc.nbuf; ++n)
+          hftirc.cb[n]->id = n;
 
-     if(!hftirc.prevcb)
+     if(hftirc.selcb == cb)
+          hftirc.selcb = NULL;
+
+     if(!hftirc.prevcb || hftirc.prevcb == cb)
           hftirc.prevcb = hftirc.statuscb;
 
+     free(cb);
+
      ui_buf_set(hftirc.prevcb->id);
 
      return;
@@ -565,7 +1201,7 @@ ui_buf_close(ChanBuf *cb)
 void
 ui_scroll_up(ChanBuf *cb)
 {
-     if(!cb || cb->bufpos + cb->scrollpos - 1 < 0)
+     if(!cb || (int)cb->scroll.n + cb->scrollpos - 1 < 0)
           return;
 
      cb->scrollpos -= (MAINWIN_LINES / 2);
@@ -579,7 +1215,7 @@ ui_scroll_up(ChanBuf *cb)
 void
 ui_scroll_down(ChanBuf *cb)
 {
-     if(!cb || cb->scrollpos >= 0 || cb->scrollpos > BUFLINES)
+     if(!cb || cb->scrollpos >= 0)
           return;
 
      cb->scrollpos += (MAINWIN_LINES / 2);
@@ -593,12 +1229,18 @@ ui_scroll_down(ChanBuf *cb)
 void
 ui_nicklist_toggle(void)
 {
+     if(!hftirc.ui.attached)
+     {
+          hftirc.ui.nicklist = !hftirc.ui.nicklist;
+          return;
+     }
+
      delwin(hftirc.ui.mainwin);
 
      if((hftirc.ui.nicklist = !hftirc.ui.nicklist))
      {
           hftirc.ui.nicklistwin = newwin(LINES - 3, ROSTERSIZE, 1, COLS - ROSTERSIZE);
-          wrefresh(hftirc.ui.nicklistwin);
+          hftirc.ui.nnickrow = 0;
           hftirc.ui.mainwin = newwin(MAINWIN_LINES, COLS - ROSTERSIZE, 1, 0);
           hftirc.selcb->umask |= UNickListMask;
           ui_update_nicklistwin();
@@ -631,22 +1273,51 @@ ui_nicklist_scroll(int v)
      return;
 }
 
+/* Swap the selected buffer with buffer n, it stays selected */
 void
 ui_buf_swap(int n)
 {
-  /*  ChanBuf old_buffer;
+     ChanBuf *cb = hftirc.selcb;
+
+     if(!cb || cb == hftirc.statuscb || n <= 0 || n > hftirc.nbuf - 1 || n == cb->id)
+          return;
+
+     hftirc.cb[cb->id] = hftirc.cb[n];
+     hftirc.cb[cb->id]->id = cb->id;
+
+     hftirc.cb[n] = cb;
+     cb->id = n;
+
+     hftirc.ui.statusmod = True;
+
+     return;
+}
+
+/* Move the selected buffer to id n, the ones between shift by one */
+void
+ui_buf_move(int n)
+{
+     ChanBuf *cb = hftirc.selcb;
+     int i, from;
+
+     if(!cb || cb == hftirc.statuscb || n <= 0 || n > hftirc.nbuf - 1 || n == cb->id)
+          return;
+
+     from = cb->id;
 
-    if(!n || !hftirc.selcb || !strcmp(hftirc.selcb->name, "status")
-                   ||  n <= 0 || n > hftirc.nbuf -1 || n == hftirc.selcb->id)
-              return;
+     if(n < from)
+          memmove(&hftirc.cb[n + 1], &hftirc.cb[n], (from - n) * sizeof(ChanBuf*));
+     else
+          memmove(&hftirc.cb[from], &hftirc.cb[from + 1], (n - from) * sizeof(ChanBuf*));
+
+     hftirc.cb[n] = cb;
 
-    old_buffer = hftirc.cb[ n ];
-    hftirc.cb[ n ] = hftirc.cb[ hftirc.selbuf ];
-    hftirc.cb[ hftirc.selbuf ] = old_buffer;
+     for(i = MIN(n, from); i <= MAX(n, from); ++i)
+          hftirc.cb[i]->id = i;
 
-    ui_buf_set(n);*/
+     hftirc.ui.statusmod = True;
 
-    return;
+     return;
 }
 
 void
@@ -656,22 +1327,103 @@ ui_set_color_theme(int col)
           return;
 
      hftirc.ui.tcolor = col;
+     hftirc.ui.statusmod = True;
      hftirc.selcb->umask |= (UTopicMask | UNickListMask);
 
      return;
 }
 
+/* Input line set to the history line n back (0: empty) */
+static void
+ui_input_histo(int n)
+{
+     wchar_t wbuf[BUFSIZE] = { 0 };
+     const char *line;
+
+     if((line = history_get(n)) && mbstowcs(wbuf, line, BUFSIZE - 1) == (size_t)-1)
+          wbuf[0] = L'\0';
+
+     hftirc.ui.ib.histpos = n;
+     edit_set(wbuf);
+
+     return;
+}
+
+/* Ctrl-R, reverse search in the history: the line shows the match.
+ * False if key ends the search and is to be handled as usual.
+ */
+static Bool
+ui_search_key(wint_t c, Bool fkey)
+{
+     char mb[MB_LEN_MAX + 1];
+     wchar_t wbuf[BUFSIZE] = { 0 };
+     const char *m = NULL;
+     int n;
+
+     if(!hftirc.ui.ib.search)
+     {
+          edit_text(hftirc.ui.ib.before, BUFSIZE);
+          hftirc.ui.ib.search = True;
+          history_search_start();
+
+          return True;
+     }
+
+     if(!fkey && c == C('r'))
+          m = history_search_next();
+     else if(c == KEY_BACKSPACE || (!fkey && c == 127))
+          m = history_search_back();
+     else if(!fkey && (c == C('g') || c == 27))
+     {
+          hftirc.ui.ib.search = False;
+          edit_set(hftirc.ui.ib.before);
+
+          return True;
+     }
+     else if(!fkey && iswprint(c) && (n = wctomb(mb, c)) > 0)
+     {
+          mb[n] = '\0';
+          m = history_search_key(mb);
+     }
+     else
+     {
+          /* Match taken, key handled on it */
+          hftirc.ui.ib.search = False;
+          hftirc.ui.ib.histpos = 0;
+          edit_redraw();
+
+          return False;
+     }
+
+     if(m && mbstowcs(wbuf, m, BUFSIZE - 1) != (size_t)-1)
+          edit_set(wbuf);
+
+     return True;
+}
+
 void
 ui_refresh_curpos(void)
 {
-     wchar_t wc;
+     wchar_t wbuf[BUFSIZE];
 
-     /* Draw cursor */
-     wmove(hftirc.ui.inputwin, 0, hftirc.ui.ib.cpos);
-     hftirc_waddwch(hftirc.ui.inputwin, A_REVERSE,
-               (!(wc = hftirc.ui.ib.buffer[hftirc.ui.ib.pos]) ? ' ' : wc));
+     if(!hftirc.ui.attached)
+          return;
 
-     wrefresh(hftirc.ui.inputwin);
+     /* Search prompt, the cursor ends it */
+     if(hftirc.ui.ib.search)
+     {
+          edit_text(wbuf, BUFSIZE);
+          werase(hftirc.ui.inputwin);
+          mvwprintw(hftirc.ui.inputwin, 0, 0, "(reverse-i-search)`%s': ", history_search_query());
+          waddwstr(hftirc.ui.inputwin, wbuf);
+          hftirc_waddwch(hftirc.ui.inputwin, A_REVERSE, ' ');
+          hftirc.ui.dirty |= WInput;
+
+          return;
+     }
+
+     /* What changed in the line and the cursor, see edit.c */
+     edit_draw();
 
      return;
 }
@@ -679,15 +1431,20 @@ ui_refresh_curpos(void)
 void
 ui_get_input(void)
 {
-     int i, j, n, b = 1, t;
+     InputBuf *ib = &hftirc.ui.ib;
+     int n, b = 1, t;
      wint_t c;
-     wchar_t tmpbuf[BUFSIZE], *cmp;
+     wchar_t wbuf[BUFSIZE], *cmp;
      char buf[BUFSIZE];
 
      switch((t = get_wch(&c)))
      {
           case ERR: break;
           default:
+               if((ib->search || (t == OK && c == C('r')))
+                         && ui_search_key(c, (t == KEY_CODE_YES)))
+                    break;
+
                switch(c)
                {
                     case KEY_F(1):
@@ -704,6 +1461,10 @@ ui_get_input(void)
                          ui_nicklist_toggle();
                          break;
 
+                    case KEY_F(4):
+                         ui_buf_urgent();
+                         break;
+
                     case KEY_F(11):
                          ui_nicklist_scroll(-(MAINWIN_LINES / 2));
                          break;
@@ -721,344 +1482,133 @@ ui_get_input(void)
                          break;
 
                     case HFTIRC_KEY_ENTER:
-                         if(hftirc.ui.ib.pos || wcslen(hftirc.ui.ib.buffer))
+                         if(edit_len())
                          {
+                              edit_text(wbuf, BUFSIZE);
                               memset(buf, 0, BUFSIZE);
+                              wcstombs(buf, wbuf, BUFSIZE);
 
-                              /* Histo */
-                              if(hftirc.ui.ib.nhisto + 1 > HISTOLEN)
-                              {
-                                   for(i = hftirc.ui.ib.nhisto - 1; i > 1; --i)
-                                        wcscpy(hftirc.ui.ib.histo[i], hftirc.ui.ib.histo[i - 1]);
+                              history_add(buf, True);
+                              ib->histpos = 0;
+
+                              /* Input line is consumed before the command runs (see /upgrade) */
+                              edit_set(L"");
+                              ib->hits = 0;
 
-                                   hftirc.ui.ib.nhisto = 0;
-                              }
-                              /* Store in histo array */
-                              wcscpy(hftirc.ui.ib.histo[hftirc.ui.ib.nhisto++], hftirc.ui.ib.buffer);
-                              hftirc.ui.ib.histpos = 0;
-                              wcstombs(buf, hftirc.ui.ib.buffer, BUFSIZE);
                               input_manage(buf);
-                              werase(hftirc.ui.inputwin);
-                              wmemset(hftirc.ui.ib.buffer, 0, BUFSIZE);
-                              hftirc.ui.ib.pos = hftirc.ui.ib.cpos = hftirc.ui.ib.split = hftirc.ui.ib.hits = 0;
                          }
                          break;
 
                     case KEY_UP:
-                         if(hftirc.ui.ib.nhisto)
-                         {
-                              if(hftirc.ui.ib.histpos >= hftirc.ui.ib.nhisto)
-                                   hftirc.ui.ib.histpos = 0;
-
-                              wmemset(hftirc.ui.ib.buffer, 0, BUFSIZE);
-                              wcscpy(hftirc.ui.ib.buffer, hftirc.ui.ib.histo[hftirc.ui.ib.nhisto - ++hftirc.ui.ib.histpos]);
-                              werase(hftirc.ui.inputwin);
-                              hftirc.ui.ib.cpos = hftirc.ui.ib.pos = wcslen(hftirc.ui.ib.buffer);
-
-                              if(hftirc.ui.ib.pos >= COLS - 1)
-                              {
-                                   hftirc.ui.ib.split = hftirc.ui.ib.pos - (COLS - 1);
-                                   hftirc.ui.ib.spting = 1;
-                                   hftirc.ui.ib.cpos = COLS - 1;
-                              }
-
-                              /* Ctrl-key are 2 char long */
-                              for(i = 0; i < wcslen(hftirc.ui.ib.buffer); ++i)
-                                   if(IS_CTRLK(hftirc.ui.ib.buffer[i]))
-                                   {
-                                        ++hftirc.ui.ib.cpos;
-                                        if(hftirc.ui.ib.spting)
-                                             ++hftirc.ui.ib.split;
-                                   }
-                         }
+                         if(ib->histpos < history_count())
+                              ui_input_histo(ib->histpos + 1);
                          break;
 
                     case KEY_DOWN:
-                         if(hftirc.ui.ib.nhisto && hftirc.ui.ib.histpos > 0
-                                   && hftirc.ui.ib.histpos < hftirc.ui.ib.nhisto)
-                         {
-                              wmemset(hftirc.ui.ib.buffer, 0, BUFSIZE);
-                              wcscpy(hftirc.ui.ib.buffer, hftirc.ui.ib.histo[hftirc.ui.ib.nhisto - --hftirc.ui.ib.histpos]);
-                              werase(hftirc.ui.inputwin);
-                              hftirc.ui.ib.cpos = hftirc.ui.ib.pos = wcslen(hftirc.ui.ib.buffer);
-
-                              if(hftirc.ui.ib.pos >= COLS - 1)
-                              {
-                                   hftirc.ui.ib.split = hftirc.ui.ib.pos - (COLS - 1);
-                                   hftirc.ui.ib.spting = 1;
-                                   hftirc.ui.ib.cpos = COLS - 1;
-                              }
-
-                              /* Ctrl-key are 2 char long */
-                              for(i = 0; i < wcslen(hftirc.ui.ib.buffer); ++i)
-                                   if(IS_CTRLK(hftirc.ui.ib.buffer[i]))
-                                   {
-                                        ++hftirc.ui.ib.cpos;
-                                        if(hftirc.ui.ib.spting)
-                                             ++hftirc.ui.ib.split;
-                                   }
-                         }
-                         else
-                              werase(hftirc.ui.inputwin);
-
+                         if(ib->histpos > 0)
+                              ui_input_histo(ib->histpos - 1);
                          break;
 
                     case KEY_LEFT:
-                         if(hftirc.ui.ib.pos >= 1
-                           && hftirc.ui.ib.cpos >= 1)
-                         {
-                              if(IS_CTRLK(hftirc.ui.ib.buffer[hftirc.ui.ib.pos - 1]))
-                                   --(hftirc.ui.ib.cpos);
-
-                              --(hftirc.ui.ib.pos);
-
-                              if(hftirc.ui.ib.spting)
-                              {
-                                    werase(hftirc.ui.inputwin);
-                                   --(hftirc.ui.ib.split);
-
-                                   if(hftirc.ui.ib.split <= 1)
-                                        hftirc.ui.ib.spting = 0;
-                              }
-                              else
-                                   --(hftirc.ui.ib.cpos);
-                         }
+                         edit_move(-1);
                          break;
 
                     case KEY_RIGHT:
-                         if(hftirc.ui.ib.buffer[hftirc.ui.ib.pos] != 0)
-                         {
-                              if(IS_CTRLK(hftirc.ui.ib.buffer[hftirc.ui.ib.pos]))
-                                   ++(hftirc.ui.ib.cpos);
-
-                              ++(hftirc.ui.ib.pos);
-
-                              if(hftirc.ui.ib.spting)
-                              {
-                                   werase(hftirc.ui.inputwin);
-                                   ++(hftirc.ui.ib.split);
-                              }
-                              else if(hftirc.ui.ib.cpos == COLS -1 && !hftirc.ui.ib.spting)
-                              {
-                                   werase(hftirc.ui.inputwin);
-                                   ++(hftirc.ui.ib.split);
-                              }
-                              else if(hftirc.ui.ib.cpos != COLS - 1)
-                                   ++(hftirc.ui.ib.cpos);
-                         }
+                         edit_move(+1);
                          break;
 
                     /* Alt-Backspace / ^W, Erase last word */
                     case HFTIRC_KEY_ALTBP:
                     case C('w'):
-                         if(hftirc.ui.ib.pos > 1)
-                         {
-                              for(i = hftirc.ui.ib.pos - 1;
-                                        (i + 1) && hftirc.ui.ib.buffer[i - 1] != ' '; --i)
-                              {
-                                   /* Ctrl-key */
-                                   if(IS_CTRLK(hftirc.ui.ib.buffer[hftirc.ui.ib.pos - 1]))
-                                   {
-                                        wmove(hftirc.ui.inputwin, 0, --hftirc.ui.ib.cpos);
-                                        wdelch(hftirc.ui.inputwin);
-                                   }
-
-                                   --(hftirc.ui.ib.pos);
-
-                                   if(hftirc.ui.ib.spting)
-                                   {
-                                        werase(hftirc.ui.inputwin);
-                                        --(hftirc.ui.ib.split);
-
-                                        if(hftirc.ui.ib.split <= 0)
-                                             hftirc.ui.ib.spting = 0;
-                                   }
-                                   else
-                                        --(hftirc.ui.ib.cpos);
-
-                                   wmove(hftirc.ui.inputwin, 0, hftirc.ui.ib.cpos);
-
-                                   if(hftirc.ui.ib.pos >= 0)
-                                        for(j = hftirc.ui.ib.pos;
-                                                  hftirc.ui.ib.buffer[j];
-                                                  hftirc.ui.ib.buffer[j] = hftirc.ui.ib.buffer[j + 1], ++j);
-                                   wdelch(hftirc.ui.inputwin);
-                              }
-                              ui_get_input();
-                         }
+                         edit_erase_word();
                          break;
 
                     case 127:
                     case KEY_BACKSPACE:
-                         if(hftirc.ui.ib.pos > 0)
-                         {
-                              /* Ctrl-key */
-                              if(IS_CTRLK(hftirc.ui.ib.buffer[hftirc.ui.ib.pos - 1]))
-                              {
-                                   wmove(hftirc.ui.inputwin, 0, --hftirc.ui.ib.cpos);
-                                   wdelch(hftirc.ui.inputwin);
-                              }
-
-                              --(hftirc.ui.ib.pos);
-
-                              if(hftirc.ui.ib.spting)
-                              {
-                                   werase(hftirc.ui.inputwin);
-                                   --(hftirc.ui.ib.split);
-
-                                   if(hftirc.ui.ib.split <= 0)
-                                        hftirc.ui.ib.spting = 0;
-                              }
-                              else
-                                   --(hftirc.ui.ib.cpos);
-
-                              wmove(hftirc.ui.inputwin, 0, hftirc.ui.ib.cpos);
-
-                              if(hftirc.ui.ib.pos >= 0)
-                                   for(i = hftirc.ui.ib.pos;
-                                             hftirc.ui.ib.buffer[i];
-                                             hftirc.ui.ib.buffer[i] = hftirc.ui.ib.buffer[i + 1], ++i);
-                              wdelch(hftirc.ui.inputwin);
-                         }
+                         /* Second half of Alt-Backspace */
+                         if(ib->prev != HFTIRC_KEY_ALTBP)
+                              edit_erase(1);
                          break;
 
                     case HFTIRC_KEY_DELALL:
-                         werase(hftirc.ui.inputwin);
-                         hftirc.ui.ib.cpos = hftirc.ui.ib.pos = 0;
-                         hftirc.ui.ib.spting = hftirc.ui.ib.split = 0;
-                         wmemset(hftirc.ui.ib.buffer, 0, BUFSIZE);
+                         edit_set(L"");
                          break;
 
                     case KEY_DC:
-                         wdelch(hftirc.ui.inputwin);
-
-                         if(hftirc.ui.ib.buffer[hftirc.ui.ib.pos] != 0 && hftirc.ui.ib.pos >= 0)
-                              for(i = hftirc.ui.ib.pos;
-                                        hftirc.ui.ib.buffer[i];
-                                        hftirc.ui.ib.buffer[i] = hftirc.ui.ib.buffer[i + 1], ++i);
-
+                         edit_erase(-1);
                          break;
 
                     case KEY_HOME:
-                         wmove(hftirc.ui.inputwin, 0, 0);
-                         hftirc.ui.ib.pos = hftirc.ui.ib.cpos = 0;
-                         hftirc.ui.ib.spting = hftirc.ui.ib.split = 0;
+                         edit_move(-BUFSIZE);
                          break;
 
                     case KEY_END:
-                         wmove(hftirc.ui.inputwin, 0, (int)wcslen(hftirc.ui.ib.buffer));
-                         hftirc.ui.ib.pos = (int)wcslen(hftirc.ui.ib.buffer);
-
-                         if(hftirc.ui.ib.spting || (int)wcslen(hftirc.ui.ib.buffer) > COLS - 1)
-                         {
-                              werase(hftirc.ui.inputwin);
-                              hftirc.ui.ib.spting = 1;
-                              hftirc.ui.ib.cpos = COLS - 1;
-                              hftirc.ui.ib.split = (int)wcslen(hftirc.ui.ib.buffer) - COLS + 1;
-                         }
-                         else
-                              hftirc.ui.ib.cpos = (int)wcslen(hftirc.ui.ib.buffer);
-
+                         edit_move(+BUFSIZE);
                          break;
 
                     case KEY_RESIZE:
                          break;
 
                     case '\t':
-                         if(hftirc.ui.ib.prev == c)
+                         if(ib->prev == c)
                          {
-                              ++hftirc.ui.ib.hits;
-                              hftirc.ui.ib.found = 0;
+                              ++ib->hits;
+                              ib->found = 0;
                          }
                          else
                          {
-                              hftirc.ui.ib.hits = 1;
-                              wcscpy(tmpbuf, hftirc.ui.ib.buffer);
+                              ib->hits = 1;
+                              edit_text(ib->before, BUFSIZE);
                          }
 
-                         if(hftirc.ui.ib.pos)
+                         if(ib->gap)
                          {
-                              cmp = (hftirc.ui.ib.buffer[0] == '/' && !wcschr(tmpbuf, ' '))
+                              cmp = (ib->before[0] == '/' && !wcschr(ib->before, ' '))
                                    /* Input /cmd completion */
-                                   ? complete_input(hftirc.selcb, hftirc.ui.ib.hits, tmpbuf)
+                                   ? complete_input(hftirc.selcb, ib->hits, ib->before)
                                    /* Nick completion */
-                                   : complete_nick(hftirc.selcb, hftirc.ui.ib.hits, tmpbuf, &b);
+                                   : complete_nick(hftirc.selcb, ib->hits, ib->before, &b);
 
                               if(cmp)
                               {
-                                   hftirc.ui.ib.found = 1;
-                                   memset(hftirc.ui.ib.buffer, 0, BUFSIZE);
-                                   wcscpy(hftirc.ui.ib.buffer, tmpbuf);
-                                   wcscat(hftirc.ui.ib.buffer, cmp);
-                                   wcscat(hftirc.ui.ib.buffer, ((b) ? L" " : L": "));
+                                   ib->found = 1;
+                                   swprintf(wbuf, BUFSIZE, L"%ls%ls%ls", ib->before, cmp, ((b) ? L" " : L": "));
+                                   edit_set(wbuf);
                                    free(cmp);
                               }
                          }
 
                          /* To circular it */
-                         if(!hftirc.ui.ib.found)
-                              hftirc.ui.ib.hits = 0;
-
-                         werase(hftirc.ui.inputwin);
-                         hftirc.ui.ib.pos = hftirc.ui.ib.cpos = wcslen(hftirc.ui.ib.buffer);
+                         if(!ib->found)
+                              ib->hits = 0;
 
                          break;
 
                     default:
-                         if((c > 0 && wcslen(hftirc.ui.ib.buffer) < BUFSIZE))
+                         /* Not the function keys we don't know */
+                         if(t == OK && c > 0)
                          {
-                              /* Ctrl-key */
-                              if(IS_CTRLK(c))
-                                   ++hftirc.ui.ib.cpos;
-
-                              if(hftirc.ui.ib.buffer[hftirc.ui.ib.pos] != '\0')
-                                   for(i = (int)wcslen(hftirc.ui.ib.buffer);
-                                             i != hftirc.ui.ib.pos - 1;
-                                             hftirc.ui.ib.buffer[i] = hftirc.ui.ib.buffer[i - 1], --i);
-
-                              hftirc.ui.ib.buffer[hftirc.ui.ib.pos] = c;
-
-                              if(hftirc.ui.ib.pos >= COLS - 1)
-                              {
-                                   ++hftirc.ui.ib.split;
-                                   --hftirc.ui.ib.cpos;
-                                   hftirc.ui.ib.spting = 1;
-                              }
-
-                              hftirc.ui.ib.hits = 1;
-
-                              ++(hftirc.ui.ib.pos);
-                              ++(hftirc.ui.ib.cpos);
+                              edit_insert(c);
+                              ib->hits = 1;
                          }
                          break;
                }
                break;
      }
 
-     hftirc.ui.ib.prev = c;
-
-     werase(hftirc.ui.inputwin);
-
-     hftirc.ui.ib.cpos = (hftirc.ui.ib.cpos < 0 ? 0 : hftirc.ui.ib.cpos);
-
-     mvwaddwstr(hftirc.ui.inputwin, 0, 0,
-               hftirc.ui.ib.buffer + hftirc.ui.ib.split);
-
-     wcstombs(buf, hftirc.ui.ib.buffer, BUFSIZE);
+     ib->prev = c;
 
      /* /<num> to go on the buffer num */
-     if(buf[0] == '/' &&
+     edit_text(wbuf, 8);
+     wcstombs(buf, wbuf, BUFSIZE);
+
+     if(!ib->search && buf[0] == '/' &&
         ((isdigit(buf[1]) && (n = atoi(&buf[1])) >= 0 && n < 10) /* /n   */
          || (buf[1] == ' ' && (n = atoi(&buf[2])) > 9)))         /* / nn */
      {
           ui_buf_set(n);
-          werase(hftirc.ui.inputwin);
-          wmemset(hftirc.ui.ib.buffer, 0, BUFSIZE);
-
-          hftirc.ui.ib.pos = hftirc.ui.ib.cpos = hftirc.ui.ib.split
-               = hftirc.ui.ib.hits = 0;
-
-          wmove(hftirc.ui.inputwin, 0, 0);
+          edit_set(L"");
+          ib->hits = 0;
      }
 
      ui_refresh_curpos();
@@ -1072,12 +1622,141 @@ ui_screen_clear()
      char *buf;
      int i;
 
+     if(!hftirc.ui.attached)
+          return;
+
      buf = "\n";
 
      for(i = 0; i < BUFFERSIZE; ++i)
           ui_print(hftirc.ui.mainwin, buf, 0);
 
-     wrefresh(hftirc.ui.mainwin);
+     hftirc.ui.dirty |= WMain;
+
+     return;
+}
+
+/* Take the terminal given by an attaching client (see control_attach()) */
+Bool
+ui_attach(int infd, int outfd, const char *term)
+{
+     FILE *in, *out;
+     SCREEN *sc;
+
+     if(hftirc.ui.attached)
+          return False;
+
+     if(!(in = fdopen(infd, "r")))
+          return False;
+
+     if(!(out = fdopen(outfd, "w")))
+     {
+          fclose(in);
+          return False;
+     }
+
+     if(!(sc = newterm((char*)term, out, in)))
+     {
+          fclose(in);
+          fclose(out);
+          return False;
+     }
+
+     hftirc.ui.screen = sc;
+     hftirc.ui.in = in;
+     hftirc.ui.out = out;
+     hftirc.ui.infd = infd;
+     hftirc.ui.owntty = False;
+     snprintf(hftirc.ui.term, sizeof(hftirc.ui.term), "%s", (term ? term : ""));
+
+     ui_init();
+     ui_buf_set(hftirc.selcb->id);
+     ui_refresh_curpos();
+
+     return True;
+}
+
+/* Leave the terminal; connections and buffers stay alive.
+ * When running in the terminal we were started from, go to background
+ * so the shell gets it back.
+ */
+void
+ui_detach(void)
+{
+     int fd;
+
+     if(!hftirc.ui.attached)
+          return;
+
+     endwin();
+     delscreen(hftirc.ui.screen);
+
+     /* Pairs belong to the screen */
+     FREEPTR(&hftirc.ui.pairs);
+
+     hftirc.ui.screen = NULL;
+     hftirc.ui.attached = False;
+     hftirc.ui.mainwin = hftirc.ui.inputwin = hftirc.ui.statuswin
+          = hftirc.ui.topicwin = hftirc.ui.nicklistwin = NULL;
+
+     if(!hftirc.ui.owntty)
+     {
+          fclose(hftirc.ui.in);
+          fclose(hftirc.ui.out);
+          hftirc.ui.in = hftirc.ui.out = NULL;
+          hftirc.ui.infd = -1;
+
+          control_detach();
+
+          return;
+     }
+
+     /* The terminal hangs up when the parent leaves, until setsid() */
+     signal(SIGHUP, SIG_IGN);
+
+     switch(fork())
+     {
+          case -1:
+               /* Can't go to background, stay here */
+               signal(SIGHUP, SIG_DFL);
+               ui_init();
+               WARN("Error", "Can't detach (fork failed)");
+               return;
+          case 0:
+               break;
+          default:
+               _exit(EXIT_SUCCESS);
+     }
+
+     setsid();
+     signal(SIGHUP, SIG_DFL);
+
+     if((fd = open("/dev/null", O_RDWR)) >= 0)
+     {
+          dup2(fd, STDIN_FILENO);
+          dup2(fd, STDOUT_FILENO);
+          dup2(fd, STDERR_FILENO);
+
+          if(fd > STDERR_FILENO)
+               close(fd);
+     }
+
+     hftirc.ui.owntty = False;
+     hftirc.ui.infd = -1;
+
+     return;
+}
+
+/* Attached terminal size changed (no SIGWINCH for us in this case) */
+void
+ui_resize(int lines, int cols)
+{
+     if(!hftirc.ui.attached)
+          return;
+
+     resizeterm(lines, cols);
+     ui_init();
+     ui_buf_set(hftirc.selcb->id);
+     ui_refresh_curpos();
 
      return;
 }
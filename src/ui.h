@@ -32,7 +32,7 @@
 #define COLOR_ROSTER  (ui_color(hftirc.ui.tcolor, hftirc.ui.bg))
 #define COLOR_ACT     (ui_color(COLOR_WHITE,  hftirc.ui.tcolor))
 #define COLOR_HLACT   (ui_color(COLOR_RED, hftirc.ui.tcolor) | A_BOLD)
-#define COLOR_LASTPOS (ui_color(COLOR_BLUE, hftirc.ui.bg | A_BOLD ))
+#define COLOR_LASTPOS (ui_color(COLOR_BLUE, hftirc.ui.bg) | A_BOLD)
 
 /* HFTIrc colors:
  * Based on ANSI colors list
@@ -108,4 +108,18 @@ static const struct { int c, m; } mirccol[] =
      { COLOR_WHITE,   A_NORMAL },
 };
 
+/* mIRC extended colors 16-98 in the 256 colors palette
+ * See: https://modern.ircdocs.horse/formatting.html#colors-16-98
+ */
+static const short mirc256[] =
+{
+     52,  94,  100, 58,  22,  29,  23,  24,  17,  54,  53,  89,  /* 16-27 */
+     88,  130, 142, 64,  28,  35,  30,  25,  18,  91,  90,  125, /* 28-39 */
+     124, 166, 184, 106, 34,  49,  37,  33,  19,  129, 127, 161, /* 40-51 */
+     196, 208, 226, 154, 46,  86,  51,  75,  21,  171, 201, 198, /* 52-63 */
+     203, 215, 227, 191, 83,  122, 87,  111, 63,  177, 207, 205, /* 64-75 */
+     217, 223, 229, 193, 157, 158, 159, 153, 147, 183, 219, 212, /* 76-87 */
+     16,  233, 235, 237, 239, 241, 244, 247, 250, 254, 231       /* 88-98 */
+};
+
 #endif /* UI_H */
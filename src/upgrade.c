@@ -0,0 +1,606 @@
+/*
+ * Copyright (c) 2010 Martin Duquesnoy <xorg62@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Hot upgrade.
+ *
+ * /upgrade writes the client state (sessions, buffers with scrollback,
+ * nick lists, topics, input line and history) to an unlinked temporary
+ * file and executes the binary again with "-U <fd>".  Server sockets, the
+ * control socket and the terminal are inherited as file descriptors, so
+ * the new binary is back without any server round-trip.
+ *
+ * The snapshot is a stream of native longs and length-prefixed strings:
+ * it is only read back on the same machine, right away.  Spilled
+ * scrollback stays in its files, only their descriptors are passed.
+ */
+
+#include <sys/time.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "hftirc.h"
+
+#define UPGRADE_MAGIC "HFTIrc upgrade 6"
+
+/* Ui state in the snapshot */
+enum { UpgradeDetached, UpgradeOwnTty, UpgradeClient };
+
+static Bool upgrade_err = False;
+
+static void
+upgrade_put_int(FILE *f, long v)
+{
+     fwrite(&v, sizeof(v), 1, f);
+
+     return;
+}
+
+static void
+upgrade_put_str(FILE *f, const char *s)
+{
+     long n = (s ? (long)strlen(s) : -1);
+
+     upgrade_put_int(f, n);
+
+     if(n > 0)
+          fwrite(s, 1, n, f);
+
+     return;
+}
+
+static void
+upgrade_put_wstr(FILE *f, const wchar_t *s)
+{
+     long n = wcslen(s);
+
+     upgrade_put_int(f, n);
+     fwrite(s, sizeof(wchar_t), n, f);
+
+     return;
+}
+
+static long
+upgrade_get_int(FILE *f)
+{
+     long v = 0;
+
+     if(fread(&v, sizeof(v), 1, f) != 1)
+          upgrade_err = True;
+
+     return v;
+}
+
+/* Read a string in dst (size bytes), or allocate it when dst is NULL */
+static char*
+upgrade_get_str(FILE *f, char *dst, size_t size)
+{
+     long n = upgrade_get_int(f);
+     char *s;
+
+     if(n < 0 || upgrade_err)
+          return NULL;
+
+     if(dst)
+     {
+          if((size_t)n >= size)
+          {
+               upgrade_err = True;
+               return NULL;
+          }
+          s = dst;
+     }
+     else
+          s = xmalloc(n + 1, sizeof(char));
+
+     if(fread(s, 1, n, f) != (size_t)n)
+          upgrade_err = True;
+
+     s[n] = '\0';
+
+     return s;
+}
+
+static void
+upgrade_get_wstr(FILE *f, wchar_t *dst, size_t size)
+{
+     long n = upgrade_get_int(f);
+
+     if(n < 0 || (size_t)n >= size)
+          upgrade_err = True;
+
+     if(upgrade_err || fread(dst, sizeof(wchar_t), n, f) != (size_t)n)
+     {
+          upgrade_err = True;
+          dst[0] = L'\0';
+          return;
+     }
+
+     dst[n] = L'\0';
+
+     return;
+}
+
+static void
+upgrade_put_buf(FILE *f, ChanBuf *cb, IrcSession **sess, int nsess)
+{
+     NickStruct *ns;
+     ScrollLine *l;
+     ScrollSpill *sp;
+     int i;
+
+     for(i = 0; i < nsess && sess[i] != cb->session; ++i);
+
+     upgrade_put_str(f, cb->name);
+     upgrade_put_int(f, (i < nsess ? i : -1));
+     upgrade_put_str(f, cb->topic);
+     upgrade_put_int(f, cb->act);
+     upgrade_put_int(f, cb->scrollpos);
+     upgrade_put_int(f, cb->lastseen);
+     upgrade_put_int(f, cb->nicklistscroll);
+     upgrade_put_int(f, cb->seq);
+
+     upgrade_put_int(f, cb->nnick);
+
+     for(ns = cb->nickhead; ns; ns = ns->next)
+     {
+          upgrade_put_int(f, ns->rang);
+          upgrade_put_str(f, ns->nick);
+     }
+
+     /* Spilled scrollback: files are inherited */
+     if((sp = cb->scroll.spill))
+     {
+          fcntl(sp->fd, F_SETFD, 0);
+          fcntl(sp->ifd, F_SETFD, 0);
+
+          upgrade_put_int(f, sp->fd);
+          upgrade_put_int(f, sp->ifd);
+          upgrade_put_int(f, sp->n);
+          upgrade_put_int(f, sp->size);
+     }
+     else
+          upgrade_put_int(f, -1);
+
+     /* Scrollback in memory, oldest line first */
+     upgrade_put_int(f, cb->scroll.nram);
+
+     for(i = (sp ? sp->n : 0); (l = scroll_line(&cb->scroll, i)); ++i)
+     {
+          upgrade_put_int(f, l->seq);
+          upgrade_put_int(f, l->time);
+          upgrade_put_int(f, l->kind);
+          upgrade_put_int(f, l->rank);
+          upgrade_put_int(f, l->color);
+          upgrade_put_str(f, l->nick);
+          upgrade_put_str(f, l->text);
+     }
+
+     return;
+}
+
+static void
+upgrade_write(FILE *f, int cfd)
+{
+     struct timeval tv;
+     IrcSession *is, **sess;
+     ChanBuf *cb;
+     wchar_t line[BUFSIZE];
+     int i, n;
+
+     gettimeofday(&tv, NULL);
+
+     upgrade_put_str(f, UPGRADE_MAGIC);
+     upgrade_put_int(f, tv.tv_sec);
+     upgrade_put_int(f, tv.tv_usec);
+     upgrade_put_int(f, hftirc.lineseq);
+
+     /* Ui */
+     if(!hftirc.ui.attached)
+          upgrade_put_int(f, UpgradeDetached);
+     else if(hftirc.ui.owntty)
+          upgrade_put_int(f, UpgradeOwnTty);
+     else
+     {
+          upgrade_put_int(f, UpgradeClient);
+          upgrade_put_int(f, cfd);
+          upgrade_put_int(f, fileno(hftirc.ui.in));
+          upgrade_put_int(f, fileno(hftirc.ui.out));
+          upgrade_put_str(f, hftirc.ui.term);
+     }
+
+     upgrade_put_int(f, hftirc.ui.nicklist);
+     upgrade_put_int(f, hftirc.ui.tcolor);
+
+     /* Control socket */
+     upgrade_put_int(f, hftirc.ctl.sock);
+     upgrade_put_int(f, hftirc.ctl.seq);
+
+     /* Input line and history */
+     edit_text(line, BUFSIZE);
+     upgrade_put_wstr(f, line);
+     upgrade_put_int(f, hftirc.ui.ib.gap);
+     upgrade_put_int(f, hftirc.ui.ib.histpos);
+     upgrade_put_int(f, history_count());
+
+     for(i = history_count(); i > 0; --i)
+          upgrade_put_str(f, history_get(i));
+
+     /* Sessions, oldest first: irc_session() attaches at head */
+     for(n = 0, is = hftirc.sessionhead; is; is = is->next, ++n);
+
+     sess = xcalloc(n + 1, sizeof(IrcSession*));
+
+     for(i = n, is = hftirc.sessionhead; is; is = is->next)
+          sess[--i] = is;
+
+     upgrade_put_int(f, n);
+
+     for(i = 0; i < n; ++i)
+     {
+          is = sess[i];
+
+          upgrade_put_int(f, is->sock);
+          upgrade_put_int(f, is->port);
+          upgrade_put_str(f, is->server);
+          upgrade_put_str(f, is->name);
+          upgrade_put_str(f, is->nick);
+          upgrade_put_str(f, is->username);
+          upgrade_put_str(f, is->realname);
+          upgrade_put_str(f, is->password);
+          upgrade_put_str(f, is->mode);
+          upgrade_put_int(f, is->motd_received);
+          upgrade_put_int(f, is->connected);
+          upgrade_put_int(f, is->casemap);
+          upgrade_put_int(f, is->inoffset);
+          fwrite(is->inbuf, 1, is->inoffset, f);
+     }
+
+     for(i = 0; i < n && sess[i] != hftirc.selsession; ++i);
+
+     upgrade_put_int(f, (i < n ? i : -1));
+
+     /* Buffers, in id order */
+     upgrade_put_int(f, hftirc.nbuf);
+     upgrade_put_int(f, (hftirc.selcb ? hftirc.selcb->id : 0));
+     upgrade_put_int(f, (hftirc.prevcb ? hftirc.prevcb->id : 0));
+
+     for(i = 0; i < hftirc.nbuf && (cb = hftirc.cb[i]); ++i)
+          upgrade_put_buf(f, cb, sess, n);
+
+     free(sess);
+
+     return;
+}
+
+/* Execute the (new) binary, keeping everything alive */
+void
+upgrade_exec(const char *path)
+{
+     FILE *f;
+     int fd, cfd, err;
+     char fdstr[16];
+     char *args[6];
+
+     if(!(f = tmpfile()))
+     {
+          WARN("Error", "Can't create upgrade snapshot");
+          return;
+     }
+
+     cfd = control_upgrade();
+     upgrade_write(f, cfd);
+     history_flush();
+
+     if(fflush(f) || ferror(f) || fseek(f, 0L, SEEK_SET))
+     {
+          WARN("Error", "Can't write upgrade snapshot");
+          fclose(f);
+          return;
+     }
+
+     fd = fileno(f);
+     fcntl(fd, F_SETFD, 0);
+     sprintf(fdstr, "%d", fd);
+
+     /* Terminal of an attached client came with close-on-exec */
+     if(hftirc.ui.attached && !hftirc.ui.owntty)
+     {
+          fcntl(fileno(hftirc.ui.in), F_SETFD, 0);
+          fcntl(fileno(hftirc.ui.out), F_SETFD, 0);
+     }
+
+     args[0] = (char*)((path && strlen(path)) ? path : hftirc.prog);
+     args[1] = "-c";
+     args[2] = hftirc.conf.path;
+     args[3] = "-U";
+     args[4] = fdstr;
+     args[5] = NULL;
+
+     if(hftirc.ui.attached)
+     {
+          endwin();
+          fflush(hftirc.ui.out);
+     }
+
+     execvp(args[0], args);
+
+     /* Still here: nothing goes to a later exec */
+     err = errno;
+     fcntl(fd, F_SETFD, FD_CLOEXEC);
+     control_upgrade_cancel();
+
+     if(hftirc.ui.attached && !hftirc.ui.owntty)
+     {
+          fcntl(fileno(hftirc.ui.in), F_SETFD, FD_CLOEXEC);
+          fcntl(fileno(hftirc.ui.out), F_SETFD, FD_CLOEXEC);
+     }
+
+     fclose(f);
+
+     if(hftirc.ui.attached)
+     {
+          refresh();
+          ui_draw_buf(hftirc.selcb);
+     }
+
+     ui_print_buf(hftirc.statuscb, "[HFTIrc] *** Can't upgrade to %s: %s",
+               args[0], strerror(err));
+
+     return;
+}
+
+static void
+upgrade_get_buf(FILE *f, IrcSession **sess, int nsess)
+{
+     ChanBuf *cb;
+     ScrollSpill *sp;
+     ScrollLine r;
+     char name[HOSTLEN], nick[NICKLEN + 1], line[BUFFERSIZE];
+     long i, n;
+
+     upgrade_get_str(f, name, sizeof(name));
+     i = upgrade_get_int(f);
+
+     if(upgrade_err)
+          return;
+
+     /* Don't let ui_buf_set() touch the buffers restored so far */
+     hftirc.selcb = NULL;
+
+     cb = ui_buf_new(name, ((i >= 0 && i < nsess) ? sess[i] : NULL));
+
+     /* The first one is the status buffer, kept out of the activity index */
+     if(!hftirc.statuscb)
+          hftirc.statuscb = cb;
+
+     upgrade_get_str(f, cb->topic, sizeof(cb->topic));
+     i = upgrade_get_int(f);
+     cb->scrollpos = upgrade_get_int(f);
+     cb->lastseen = upgrade_get_int(f);
+     cb->nicklistscroll = upgrade_get_int(f);
+     cb->seq = upgrade_get_int(f);
+     ui_buf_act(cb, i);
+
+     if(cb->scrollpos > 0)
+          cb->scrollpos = 0;
+
+     for(n = upgrade_get_int(f); n > 0 && !upgrade_err; --n)
+     {
+          i = upgrade_get_int(f);
+          upgrade_get_str(f, nick, sizeof(nick));
+          nick_attach(cb, nick, i);
+     }
+
+     if((i = upgrade_get_int(f)) >= 0)
+     {
+          sp = cb->scroll.spill = xcalloc(1, sizeof(ScrollSpill));
+          sp->fd = i;
+          sp->ifd = upgrade_get_int(f);
+          sp->n = cb->scroll.n = upgrade_get_int(f);
+          sp->size = upgrade_get_int(f);
+
+          fcntl(sp->fd, F_SETFD, FD_CLOEXEC);
+          fcntl(sp->ifd, F_SETFD, FD_CLOEXEC);
+     }
+
+     for(n = upgrade_get_int(f); n > 0 && !upgrade_err; --n)
+     {
+          memset(&r, 0, sizeof(r));
+          r.seq = upgrade_get_int(f);
+          r.time = upgrade_get_int(f);
+          r.kind = upgrade_get_int(f);
+          r.rank = upgrade_get_int(f);
+          r.color = upgrade_get_int(f);
+          r.nick = upgrade_get_str(f, nick, sizeof(nick));
+
+          if((r.text = upgrade_get_str(f, line, sizeof(line))))
+          {
+               r.len = strlen(line);
+               scroll_add(&cb->scroll, &r);
+          }
+     }
+
+     cb->umask |= (UTopicMask | UNickListMask);
+
+     return;
+}
+
+/* Called instead of ui_init()/irc_init()/control_init() after an upgrade */
+void
+upgrade_restore(int fd)
+{
+     FILE *f;
+     struct timeval tv, now;
+     IrcSession *is, **sess = NULL;
+     ChanBuf *cb;
+     char magic[32], term[64], line[BUFSIZE];
+     wchar_t wline[BUFSIZE];
+     int uimode, cfd = -1, infd = -1, outfd = -1, nicklist, tcolor;
+     long i, n, selsess, selid, previd;
+
+     fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+     if(!(f = fdopen(fd, "r")))
+          errx(EXIT_FAILURE, "Can't read upgrade snapshot");
+
+     upgrade_get_str(f, magic, sizeof(magic));
+
+     if(upgrade_err || strcmp(magic, UPGRADE_MAGIC))
+          errx(EXIT_FAILURE, "Invalid upgrade snapshot");
+
+     tv.tv_sec = upgrade_get_int(f);
+     tv.tv_usec = upgrade_get_int(f);
+     hftirc.lineseq = upgrade_get_int(f);
+
+     term[0] = '\0';
+
+     if((uimode = upgrade_get_int(f)) == UpgradeClient)
+     {
+          cfd = upgrade_get_int(f);
+          infd = upgrade_get_int(f);
+          outfd = upgrade_get_int(f);
+          upgrade_get_str(f, term, sizeof(term));
+     }
+
+     nicklist = upgrade_get_int(f);
+     tcolor = upgrade_get_int(f);
+
+     hftirc.ctl.sock = upgrade_get_int(f);
+     hftirc.ctl.seq = upgrade_get_int(f);
+
+     upgrade_get_wstr(f, wline, BUFSIZE);
+     edit_set(wline);
+     edit_move(upgrade_get_int(f) - edit_len());
+     hftirc.ui.ib.histpos = upgrade_get_int(f);
+
+     /* Already in the file */
+     for(i = upgrade_get_int(f); i > 0 && upgrade_get_str(f, line, sizeof(line)); --i)
+          history_add(line, False);
+
+     /* Sessions */
+     n = upgrade_get_int(f);
+
+     if(!upgrade_err && n >= 0)
+     {
+          sess = xcalloc(n + 1, sizeof(IrcSession*));
+
+          for(i = 0; i < n && !upgrade_err; ++i)
+          {
+               is = sess[i] = irc_session();
+
+               is->sock = upgrade_get_int(f);
+               is->port = upgrade_get_int(f);
+               is->server = upgrade_get_str(f, NULL, 0);
+               is->name = upgrade_get_str(f, NULL, 0);
+               is->nick = upgrade_get_str(f, NULL, 0);
+               is->username = upgrade_get_str(f, NULL, 0);
+               is->realname = upgrade_get_str(f, NULL, 0);
+               is->password = upgrade_get_str(f, NULL, 0);
+               is->mode = upgrade_get_str(f, NULL, 0);
+               is->motd_received = upgrade_get_int(f);
+               is->connected = upgrade_get_int(f);
+
+               if((is->casemap = upgrade_get_int(f)) < CaseRfc1459 || is->casemap > CaseStrict)
+                    is->casemap = CaseRfc1459;
+
+               is->inoffset = upgrade_get_int(f);
+               is->charset = charset_conf(is->name, NULL);
+
+               if(is->inoffset >= sizeof(is->inbuf)
+                         || fread(is->inbuf, 1, is->inoffset, f) != is->inoffset)
+               {
+                    is->inoffset = 0;
+                    upgrade_err = True;
+               }
+
+               if(is->sock >= 0)
+                    fcntl(is->sock, F_SETFD, 0);
+          }
+
+          n = i;
+     }
+     else
+          n = 0;
+
+     selsess = upgrade_get_int(f);
+     hftirc.selsession = ((selsess >= 0 && selsess < n) ? sess[selsess] : NULL);
+
+     /* Buffers; the first one is the status buffer */
+     hftirc.ft = 0;
+     hftirc.nbuf = 0;
+
+     i = upgrade_get_int(f);
+     selid = upgrade_get_int(f);
+     previd = upgrade_get_int(f);
+
+     for(; i > 0 && !upgrade_err; --i)
+          upgrade_get_buf(f, sess, n);
+
+     if(!hftirc.nbuf)
+          ui_buf_new("status", hftirc.selsession);
+
+     hftirc.statuscb = hftirc.cb[0];
+
+     if(!(hftirc.selcb = find_buf_wid(selid)))
+          hftirc.selcb = hftirc.statuscb;
+
+     if(!(hftirc.prevcb = find_buf_wid(previd)))
+          hftirc.prevcb = hftirc.statuscb;
+
+     if(hftirc.selcb != hftirc.statuscb)
+          hftirc.selsession = hftirc.selcb->session;
+
+     fclose(f);
+     free(sess);
+
+     /* Ui */
+     hftirc.ui.nicklist = nicklist;
+     hftirc.ui.tcolor = tcolor;
+     hftirc.ui.infd = -1;
+
+     cb = hftirc.prevcb;
+
+     switch(uimode)
+     {
+          case UpgradeOwnTty:
+               control_restore(hftirc.ctl.sock, -1, -1, -1, NULL);
+               ui_init();
+               ui_buf_set(hftirc.selcb->id);
+               break;
+          case UpgradeClient:
+               control_restore(hftirc.ctl.sock, cfd, infd, outfd, term);
+               break;
+          default:
+               control_restore(hftirc.ctl.sock, -1, -1, -1, NULL);
+               break;
+     }
+
+     if(uimode != UpgradeClient && cfd >= 0)
+          close(cfd);
+
+     hftirc.prevcb = cb;
+
+     update_date();
+     gettimeofday(&now, NULL);
+
+     if(upgrade_err)
+          WARN("Error", "Upgrade snapshot truncated, some state is lost");
+
+     ui_print_buf(hftirc.statuscb, "[HFTIrc] *** Upgraded in %ld ms",
+               (long)((now.tv_sec - tv.tv_sec) * 1000 + (now.tv_usec - tv.tv_usec) / 1000));
+
+     return;
+}
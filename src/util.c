@@ -60,6 +60,21 @@ xmalloc(size_t nmemb, size_t size)
      return ret;
 }
 
+void*
+xrealloc(void *ptr, size_t nmemb, size_t size)
+{
+     void *ret;
+
+     if(SIZE_MAX / nmemb < size)
+          err(EXIT_FAILURE, "xrealloc(%zu, %zu), "
+                    "size_t overflow detected", nmemb, size);
+
+     if((ret = realloc(ptr, nmemb * size)) == NULL)
+          err(EXIT_FAILURE, "realloc(%zu)", nmemb * size);
+
+     return ret;
+}
+
 /** asprintf wrapper
  * \param strp target string
  * \param fmt format
@@ -100,10 +115,195 @@ xstrdup(const char *str)
 void
 update_date(void)
 {
+     time_t t = time(NULL);
+
+     /* Only once per second */
+     if(t == hftirc.date.lt)
+          return;
+
+     hftirc.date.lt = t;
      hftirc.date.tm = localtime(&hftirc.date.lt);
-     hftirc.date.lt = time(NULL);
 
      strftime(hftirc.date.str, sizeof(hftirc.date.str), hftirc.conf.datef, hftirc.date.tm);
+     hftirc.ui.statusmod = True;
+
+     return;
+}
+
+/* Date of a line, formatted when drawn; lines come in bursts of the same
+ * second, so keep the last one beside the current date.
+ */
+char*
+date_str(time_t t)
+{
+     static time_t last = -1;
+     static char str[256];
+
+     if(t == hftirc.date.lt)
+          return hftirc.date.str;
+
+     if(t != last)
+     {
+          last = t;
+          strftime(str, sizeof(str), hftirc.conf.datef, localtime(&t));
+     }
+
+     return str;
+}
+
+/* Case folding of a server CASEMAPPING (Case*): rfc1459 folds []\~ to
+ * {}|^ too, strict-rfc1459 all but ~.
+ */
+static unsigned char casetab[3][256];
+
+static const unsigned char*
+casemap_table(int casemap)
+{
+     int c, m;
+
+     if(!casetab[0]['A'])
+          for(m = 0; m < 3; ++m)
+               for(c = 0; c < 256; ++c)
+               {
+                    casetab[m][c] = ((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+
+                    if(m != CaseAscii && c >= '[' && c <= (m == CaseStrict ? ']' : '^'))
+                         casetab[m][c] = c + ('{' - '[');
+               }
+
+     return casetab[casemap];
+}
+
+int
+irc_strcasecmp(IrcSession *s, const char *a, const char *b)
+{
+     const unsigned char *t = casemap_table(s ? s->casemap : CaseRfc1459);
+     const unsigned char *p = (const unsigned char*)a, *q = (const unsigned char*)b;
+
+     for(; *p && t[*p] == t[*q]; ++p, ++q);
+
+     return t[*p] - t[*q];
+}
+
+int
+irc_strncasecmp(IrcSession *s, const char *a, const char *b, size_t n)
+{
+     const unsigned char *t = casemap_table(s ? s->casemap : CaseRfc1459);
+     const unsigned char *p = (const unsigned char*)a, *q = (const unsigned char*)b;
+
+     if(!n)
+          return 0;
+
+     for(; --n && *p && t[*p] == t[*q]; ++p, ++q);
+
+     return t[*p] - t[*q];
+}
+
+/* FNV-1a of the folded name */
+unsigned int
+irc_strhash(IrcSession *s, const char *str)
+{
+     const unsigned char *t = casemap_table(s ? s->casemap : CaseRfc1459);
+     const unsigned char *p = (const unsigned char*)str;
+     unsigned int h = 2166136261U;
+
+     for(; *p; ++p)
+          h = (h ^ t[*p]) * 16777619U;
+
+     return h;
+}
+
+/* (Re)build the buffer table of s with size buckets, hashes are computed
+ * again: CASEMAPPING may have changed.
+ */
+static void
+buf_hash_resize(IrcSession *s, int size)
+{
+     ChanBuf **tab, *cb, *next;
+     int i;
+
+     tab = xcalloc(size, sizeof(ChanBuf*));
+
+     for(i = 0; i < s->nbuftab; ++i)
+          for(cb = s->buftab[i]; cb; cb = next)
+          {
+               next = cb->hnext;
+               cb->hash = irc_strhash(s, cb->name);
+               cb->hnext = tab[cb->hash & (size - 1)];
+               tab[cb->hash & (size - 1)] = cb;
+          }
+
+     free(s->buftab);
+     s->buftab = tab;
+     s->nbuftab = size;
+
+     return;
+}
+
+/* Index cb by its name in the table of its session */
+void
+buf_hash_add(ChanBuf *cb)
+{
+     IrcSession *s = cb->session;
+
+     if(!s)
+          return;
+
+     if(s->nbufhash >= s->nbuftab)
+          buf_hash_resize(s, (s->nbuftab ? s->nbuftab * 2 : 64));
+
+     ++s->nbufhash;
+     cb->hash = irc_strhash(s, cb->name);
+     cb->hnext = s->buftab[cb->hash & (s->nbuftab - 1)];
+     s->buftab[cb->hash & (s->nbuftab - 1)] = cb;
+
+     return;
+}
+
+void
+buf_hash_del(ChanBuf *cb)
+{
+     IrcSession *s = cb->session;
+     ChanBuf **p;
+
+     if(!s || !s->nbuftab)
+          return;
+
+     for(p = &s->buftab[cb->hash & (s->nbuftab - 1)]; *p; p = &(*p)->hnext)
+          if(*p == cb)
+          {
+               *p = cb->hnext;
+               --s->nbufhash;
+               break;
+          }
+
+     return;
+}
+
+/* CASEMAPPING advertised by the server (RPL_ISUPPORT) */
+void
+irc_casemap(IrcSession *s, const char *name)
+{
+     int i, m = CaseRfc1459;
+
+     if(!strcasecmp(name, "ascii"))
+          m = CaseAscii;
+     else if(!strcasecmp(name, "strict-rfc1459"))
+          m = CaseStrict;
+
+     if(m != s->casemap)
+     {
+          s->casemap = m;
+
+          if(s->nbuftab)
+               buf_hash_resize(s, s->nbuftab);
+
+          user_reindex(s);
+
+          for(i = 0; i < hftirc.nbuf; ++i)
+               if(hftirc.cb[i]->session == s)
+                    nick_reindex(hftirc.cb[i]);
+     }
 
      return;
 }
@@ -113,14 +313,16 @@ ChanBuf*
 find_buf(IrcSession *s, const char *str)
 {
      ChanBuf *cb;
+     unsigned int h;
 
-     if(!str)
+     if(!str || !s || !s->nbuftab)
           return hftirc.statuscb;
 
-     for(cb = hftirc.cbhead; cb; cb = cb->next)
-          if(cb->name && strlen(cb->name) > 1)
-               if(!strcasecmp(str, cb->name) && cb->session == s)
-                    return cb;
+     h = irc_strhash(s, str);
+
+     for(cb = s->buftab[h & (s->nbuftab - 1)]; cb; cb = cb->hnext)
+          if(cb->hash == h && strlen(cb->name) > 1 && !irc_strcasecmp(s, str, cb->name))
+               return cb;
 
      return hftirc.statuscb;
 }
@@ -129,60 +331,28 @@ find_buf(IrcSession *s, const char *str)
 ChanBuf*
 find_buf_wid(int id)
 {
-     ChanBuf *cb;
-
      if(id < 0 || id > hftirc.nbuf - 1)
           return NULL;
 
-     for(cb = hftirc.cbhead; cb; cb = cb->next)
-          if(cb->id == id)
-               return cb;
-
-     return NULL;
+     return hftirc.cb[id];
 }
 
 /* Send message to each buffer with session id = sess */
 void
 msg_sessbuf(IrcSession *session, char *str)
 {
-     ChanBuf *cb;
+     int i;
 
      if(!str)
           return;
 
-     for(cb = hftirc.cbhead->next; cb; cb = cb->next)
-          if(cb->session == session)
-               ui_print_buf(cb, str);
+     for(i = 1; i < hftirc.nbuf; ++i)
+          if(hftirc.cb[i]->session == session)
+               ui_print_buf(hftirc.cb[i], str);
 
      return;
 }
 
-/* For compatibility with FreeBSD 7.x */
-static int
-hft_wcsncasecmp(const wchar_t *s1, const wchar_t *s2, int n)
-{
-     int lc1, lc2, diff;
-
-     if(!s1 || !s2)
-          return -1;
-
-     for(lc1 = lc2 = diff = 0 ; n-- > 0 ;++s1, ++s2)
-     {
-
-          lc1 = towlower(*s1);
-          lc2 = towlower(*s2);
-          diff = lc1 - lc2;
-
-          if(diff)
-               return diff;
-
-          if(!lc1)
-               return 0;
-     }
-
-     return 0;
-}
-
 int
 color_to_id(char *name)
 {
@@ -220,20 +390,11 @@ colorstr(int color, char *str, ...)
      return ret;
 }
 
-/* Generate a color for each nick and return string with
- * nick string and color sequence
- */
-char*
-nick_color(char *nick)
+/* Generate a color for each nick, it's kept in its user (see nick.c) */
+int
+nick_colornum(const char *nick)
 {
      int i, col;
-     static char ret[NICKLEN + 6] = { 0 };
-
-     if(!nick)
-          return NULL;
-
-     if(!hftirc.conf.nickcolor)
-          return nick;
 
      /* To find color number, we add all char of the nick string */
      for(i = col = 0; nick[i]; col += tolower(nick[i++]));
@@ -241,7 +402,24 @@ nick_color(char *nick)
      /* Check if color is different of black & hl color */
      for(col %= LastCol; col == Black || col == LightYellow; ++col);
 
-     sprintf(ret, "%c%d%s%c", HFTIRC_COLOR, abs(col), nick, HFTIRC_END_COLOR);
+     return abs(col);
+}
+
+/* Return string with nick string and color sequence of color col
+ * (0: none)
+ */
+char*
+nick_color(const char *nick, int col)
+{
+     static char ret[NICKLEN + 6] = { 0 };
+
+     if(!nick)
+          return NULL;
+
+     if(!hftirc.conf.nickcolor || !col)
+          return (char*)nick;
+
+     snprintf(ret, sizeof(ret), "%c%d%s%c", HFTIRC_COLOR, col, nick, HFTIRC_END_COLOR);
 
      return ret;
 }
@@ -263,12 +441,270 @@ hftirc_waddwch(WINDOW *w, unsigned int mask, wchar_t wch)
      return ret;
 }
 
+/* Decode the UTF-8 character at s (len bytes at most) in *wc and
+ * return its length.  Bytes that don't start a valid sequence are taken
+ * as Latin-1, still the most common other charset on IRC.
+ */
+int
+utf8_decode(const char *s, int len, wchar_t *wc)
+{
+     const unsigned char *u = (const unsigned char*)s;
+     unsigned long c;
+     int i, n;
+
+     if(u[0] < 0x80)
+     {
+          *wc = u[0];
+          return 1;
+     }
+
+     if(u[0] >= 0xC2 && u[0] <= 0xDF)
+     {
+          n = 2;
+          c = u[0] & 0x1F;
+     }
+     else if(u[0] >= 0xE0 && u[0] <= 0xEF)
+     {
+          n = 3;
+          c = u[0] & 0x0F;
+     }
+     else if(u[0] >= 0xF0 && u[0] <= 0xF4)
+     {
+          n = 4;
+          c = u[0] & 0x07;
+     }
+     else
+          n = 0;
+
+     for(i = 1; i < n && i < len && (u[i] & 0xC0) == 0x80; ++i)
+          c = (c << 6) | (u[i] & 0x3F);
+
+     /* Truncated, overlong, surrogate or out of range */
+     if(!n || i < n
+               || (n == 3 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF)))
+               || (n == 4 && (c < 0x10000 || c > 0x10FFFF)))
+     {
+          *wc = u[0];
+          return 1;
+     }
+
+     *wc = (wchar_t)c;
+
+     return n;
+}
+
+/* Length of the pure ASCII start of s (len bytes at most) */
+int
+ascii_len(const char *s, int len)
+{
+     int i = 0;
+#ifdef __SSE2__
+     /* 16 bytes at a time: no high bit set */
+     for(; i + 16 <= len; i += 16)
+          if(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + i))))
+               break;
+#endif /* __SSE2__ */
+
+     for(; i < len && !(s[i] & 0x80); ++i);
+
+     return i;
+}
+
+/* True if the len bytes of s are valid UTF-8; ASCII parts are skipped
+ * with ascii_len().
+ */
+Bool
+utf8_valid(const char *s, int len)
+{
+     wchar_t wc;
+     int i, n;
+
+     for(i = ascii_len(s, len); i < len; i += ascii_len(s + i, len - i))
+     {
+          /* utf8_decode() takes a lone byte >= 0x80 as Latin-1 */
+          if((n = utf8_decode(s + i, len - i, &wc)) == 1)
+               return False;
+
+          i += n;
+     }
+
+     return True;
+}
+
+/* Columns taken by c, -1 if not printable.
+ * wcwidth() is called once per character of a 256 characters block,
+ * the first time a character of the block is drawn; blocks of a single
+ * width (most of them) all share the same table.
+ */
+int
+wc_width(wchar_t c)
+{
+     static signed char *block[(0x10FFFF >> 8) + 1];
+     static signed char same[4][0x100];
+     signed char w[0x100];
+     unsigned long b = (unsigned long)c >> 8;
+     int i;
+
+     if(c < 0x7F)
+          return (c >= 0x20 ? 1 : -1);
+
+     if(b >= LEN(block))
+          return -1;
+
+     if(!block[b])
+     {
+          for(i = 0; i < 0x100; ++i)
+               w[i] = wcwidth((wchar_t)((b << 8) | i));
+
+          for(i = 1; i < 0x100 && w[i] == w[0]; ++i);
+
+          if(i == 0x100 && w[0] >= -1 && w[0] <= 2)
+          {
+               block[b] = same[w[0] + 1];
+               memset(block[b], w[0], 0x100);
+          }
+          else
+          {
+               block[b] = xmalloc(0x100, 1);
+               memcpy(block[b], w, 0x100);
+          }
+     }
+
+     return block[b][c & 0xFF];
+}
+
+/* Tab completion.
+ *
+ * The first Tab looks the word up and keeps the candidates, best first;
+ * the next ones only cycle through them.  Nicks come from the ordered
+ * index of the channel (nick_prefix()), those who spoke last first;
+ * channels from the buffers of every session, the last active first.
+ */
+static struct
+{
+     char (*word)[HOSTLEN];
+     int n;
+} comp;
+
+static void
+complete_add(const char *word)
+{
+     int i;
+
+     if(comp.n >= COMPMAX)
+          return;
+
+     for(i = 0; i < comp.n; ++i)
+          if(!strcmp(comp.word[i], word))
+               return;
+
+     if(!comp.word)
+          comp.word = xmalloc(COMPMAX, sizeof(*comp.word));
+
+     strncpy(comp.word[comp.n], word, HOSTLEN - 1);
+     comp.word[comp.n++][HOSTLEN - 1] = '\0';
+
+     return;
+}
+
+/* hits-th candidate, without the prefix of len characters */
+static wchar_t*
+complete_get(unsigned int hits, int len)
+{
+     wchar_t wbuf[HOSTLEN];
+
+     if(hits > (unsigned int)comp.n
+               || mbstowcs(wbuf, comp.word[hits - 1], HOSTLEN) == (size_t)-1)
+          return NULL;
+
+     wbuf[HOSTLEN - 1] = L'\0';
+
+     return wcsdup(wbuf + MIN((int)wcslen(wbuf), len));
+}
+
+static int
+complete_seq_cmp(const void *a, const void *b)
+{
+     unsigned long x = (*(NickStruct**)a)->seq, y = (*(NickStruct**)b)->seq;
+
+     return (x < y) - (x > y);
+}
+
+static int
+complete_buf_cmp(const void *a, const void *b)
+{
+     const ChanBuf *x = *(ChanBuf**)a, *y = *(ChanBuf**)b;
+
+     if(x->seq != y->seq)
+          return (x->seq < y->seq) - (x->seq > y->seq);
+
+     return x->id - y->id;
+}
+
+static void
+complete_nicks(ChanBuf *cb, const char *prefix)
+{
+     NickStruct **ns, **spoke;
+     int i, j, n;
+
+     if(!(ns = nick_prefix(cb, prefix, &n)))
+          return;
+
+     /* Those who spoke first, the last one first (each line has its
+      * own seq), then the others in nicklist order
+      */
+     spoke = xmalloc(n, sizeof(NickStruct*));
+
+     for(i = j = 0; i < n; ++i)
+          if(ns[i]->seq)
+               spoke[j++] = ns[i];
+
+     qsort(spoke, j, sizeof(NickStruct*), complete_seq_cmp);
+
+     for(i = 0; i < j; ++i)
+          complete_add(spoke[i]->nick);
+
+     for(i = 0; i < n; ++i)
+          if(!ns[i]->seq)
+               complete_add(ns[i]->nick);
+
+     free(spoke);
+     free(ns);
+
+     return;
+}
+
+static void
+complete_chans(const char *prefix)
+{
+     ChanBuf *cb, **cbs;
+     int i, n = 0;
+
+     cbs = xmalloc(MAX(hftirc.nbuf, 1), sizeof(ChanBuf*));
+
+     for(i = 0; i < hftirc.nbuf && (cb = hftirc.cb[i]); ++i)
+          if(ISCHAN(cb->name[0])
+                    && !irc_strncasecmp(cb->session, cb->name, prefix, strlen(prefix)))
+               cbs[n++] = cb;
+
+     qsort(cbs, n, sizeof(ChanBuf*), complete_buf_cmp);
+
+     for(i = 0; i < n; ++i)
+          complete_add(cbs[i]->name);
+
+     free(cbs);
+
+     return;
+}
+
+/* Completion of the last word of start, *beg is 0 if it's the first one
+ * (and not a channel): a ": " follows it then.
+ */
 wchar_t*
 complete_nick(ChanBuf *cb, unsigned int hits, wchar_t *start, int *beg)
 {
-     NickStruct *ns;
-     wchar_t wbuf[BUFSIZE] = { 0 };
-     int i, c = 0;
+     char prefix[HOSTLEN];
+     int i;
 
      if(!start || hits <= 0)
           return NULL;
@@ -283,22 +719,31 @@ complete_nick(ChanBuf *cb, unsigned int hits, wchar_t *start, int *beg)
 
      *beg = i;
 
-     for(ns = cb->nickhead; ns; ns = ns->next)
+     if(wcstombs(prefix, start, HOSTLEN) >= HOSTLEN)
+          return NULL;
+
+     if(hits == 1)
      {
-          swprintf(wbuf, BUFSIZE, L"%s", ns->nick);
-          if(!hft_wcsncasecmp(wbuf, start, wcslen(start)))
-               if(++c == hits)
-                    return wcsdup(wbuf + wcslen(start));
+          comp.n = 0;
+
+          if(ISCHAN(prefix[0]))
+               complete_chans(prefix);
+          else
+               complete_nicks(cb, prefix);
      }
 
-     return NULL;
+     if(ISCHAN(prefix[0]))
+          *beg = 1;
+
+     return complete_get(hits, wcslen(start));
 }
 
 wchar_t*
 complete_input(ChanBuf *cb, unsigned int hits, wchar_t *start)
 {
-     wchar_t wbuf[BUFSIZE] = { 0 };
-     int i, c = 0;
+     const char *res[COMPMAX];
+     char prefix[HOSTLEN];
+     int i, n;
 
      if(!start || start[0] != '/' || hits <= 0)
           return NULL;
@@ -306,14 +751,21 @@ complete_input(ChanBuf *cb, unsigned int hits, wchar_t *start)
      /* Erase / */
      ++start;
 
-     for(i = 0; i < LEN(input_struct); ++i)
+     if(wcstombs(prefix, start, HOSTLEN) >= HOSTLEN)
+          return NULL;
+
+     /* Commands and aliases, see input.c */
+     if(hits == 1)
      {
-          swprintf(wbuf, BUFSIZE, L"%s", input_struct[i].cmd);
-          if(!hft_wcsncasecmp(wbuf, start, wcslen(start)))
-               if(++c == hits)
-                    return wcsdup(wbuf + wcslen(start));
+          comp.n = 0;
+
+          for(i = 0; prefix[i]; ++i)
+               prefix[i] = tolower(prefix[i]);
+
+          for(i = 0, n = input_complete(prefix, res, COMPMAX); i < n; ++i)
+               complete_add(res[i]);
      }
 
-     return NULL;
+     return complete_get(hits, wcslen(start));
 }
 